@@ -17,14 +17,16 @@ private:
     mutable std::mutex mut;
     std::queue<T> data;
     std::condition_variable cond;
+    bool closed; // no more elements will be pushed, protected by mut
 public:
-    ThreadSafeQueue()
+    ThreadSafeQueue() : closed(false)
     {
     }
     ThreadSafeQueue(const ThreadSafeQueue& other)
     {
         std::lock_guard<std::mutex> lk(other.mut);
         data = other.data;
+        closed = other.closed;
     }
     ThreadSafeQueue& operator=(const ThreadSafeQueue&) = delete;
     void push(T value)
@@ -55,21 +57,59 @@ public:
         data.pop();
         return res;
     }
-    void wait_and_pop(T& value)
+    // return false if queue is closed and drained.
+    bool wait_and_pop(T& value)
     {
         std::unique_lock ul(mut);
-        cond.wait(ul, [this] { return !data.empty(); });
+        cond.wait(ul, [this] { return !data.empty() || closed; });
+        if (data.empty())
+        {
+            return false;
+        }
         value = std::move(data.front());
         data.pop();
+        return true;
     }
+    // return empty shared_ptr if queue is closed and drained.
     std::shared_ptr<T> wait_and_pop()
     {
         std::unique_lock ul(mut);
-        cond.wait(ul, [this] { return !data.empty(); });
+        cond.wait(ul, [this] { return !data.empty() || closed; });
+        if (data.empty())
+        {
+            return std::shared_ptr<T>();
+        }
         std::shared_ptr<T> res = std::make_shared<T>(std::move(data.front()));
         data.pop();
         return res;
     }
+    // return false if timeout, or queue is closed and drained.
+    template<typename Rep, typename Period>
+    bool wait_pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        std::unique_lock ul(mut);
+        if (!cond.wait_for(ul, timeout, [this] { return !data.empty() || closed; }) || data.empty())
+        {
+            return false;
+        }
+        value = std::move(data.front());
+        data.pop();
+        return true;
+    }
+    // called by producer after the last push, wake up all waiting consumers.
+    void close()
+    {
+        {
+            std::lock_guard lg(mut);
+            closed = true;
+        }
+        cond.notify_all();
+    }
+    bool drained() const
+    {
+        std::lock_guard lg(mut);
+        return closed && data.empty();
+    }
     bool empty() const
     {
         std::lock_guard lg(mut);
@@ -80,7 +120,6 @@ public:
 // application
 ThreadSafeQueue<double> Q;
 std::mutex mcout; // for cout
-std::atomic_flag end_of_produce { ATOMIC_FLAG_INIT };
 void producer()
 {
     for (int i = 0; i < 100; ++i)
@@ -92,18 +131,15 @@ void producer()
         }
         std::this_thread::sleep_for(10ms);
     }
-    end_of_produce.test_and_set();
+    Q.close();
 }
 void consumer()
 {
-    while (!end_of_produce.test())
+    double value {};
+    while (Q.wait_and_pop(value)) // block until an element arrives, or queue is closed and drained.
     {
-        if (auto sp = Q.try_pop())
-        {
-            std::lock_guard lg(mcout);
-            std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : comsumer : " << std::setw(2) << *sp << " -" << std::endl;
-        }
-        std::this_thread::sleep_for(20ms);
+        std::lock_guard lg(mcout);
+        std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : comsumer : " << std::setw(2) << value << " -" << std::endl;
     }
 }
 
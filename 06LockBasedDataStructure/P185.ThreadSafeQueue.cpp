@@ -2,11 +2,17 @@
 #include <iomanip>
 #include <mutex>
 #include <future>
+#include <condition_variable>
 #include <thread>
 #include <memory>
 #include <chrono>
 #include <vector>
 #include <queue>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+#include <limits>
+#include <cassert>
 
 using namespace std::chrono_literals;
 
@@ -17,8 +23,18 @@ private:
     mutable std::mutex mut;
     std::queue<std::shared_ptr<T>> data;
     std::condition_variable cond;
+    bool closed; // no more elements will be pushed, protected by mut
+    void pop_bulk(std::vector<std::shared_ptr<T>>& res, std::size_t maxN) // mut must be locked
+    {
+        res.reserve(std::min(maxN, data.size())); // only what will be popped, maxN may be huge (e.g. SIZE_MAX to drain)
+        while (!data.empty() && res.size() < maxN)
+        {
+            res.push_back(std::move(data.front())); // nothrow, capacity is reserved
+            data.pop();
+        }
+    }
 public:
-    ThreadSafeQueue()
+    ThreadSafeQueue() : closed(false)
     {
     }
     ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
@@ -30,6 +46,61 @@ public:
         data.push(newValuePtr);
         cond.notify_one();
     }
+    // push [first, last) with one lock, elements are allocated out of lock.
+    template<typename InputIt>
+    void push_range(InputIt first, InputIt last)
+    {
+        std::vector<std::shared_ptr<T>> newValues;
+        for (; first != last; ++first)
+        {
+            newValues.push_back(std::make_shared<T>(*first));
+        }
+        if (newValues.empty())
+        {
+            return;
+        }
+        {
+            std::lock_guard lg(mut);
+            for (auto& sp : newValues)
+            {
+                data.push(std::move(sp));
+            }
+        }
+        if (newValues.size() == 1)
+        {
+            cond.notify_one();
+        }
+        else
+        {
+            cond.notify_all();
+        }
+    }
+    // pop at most maxN elements with one lock, write them to out (as std::shared_ptr<T>), return count of popped elements.
+    template<typename OutputIt>
+    std::size_t try_pop_bulk(OutputIt out, std::size_t maxN)
+    {
+        std::vector<std::shared_ptr<T>> res;
+        {
+            std::lock_guard lg(mut);
+            pop_bulk(res, maxN);
+        }
+        std::move(res.begin(), res.end(), out);
+        return res.size();
+    }
+    // wait until at least one element is available, then pop at most maxN elements.
+    // return 0 if queue is closed and drained.
+    template<typename OutputIt>
+    std::size_t wait_pop_bulk(OutputIt out, std::size_t maxN)
+    {
+        std::vector<std::shared_ptr<T>> res;
+        {
+            std::unique_lock ul(mut);
+            cond.wait(ul, [this] { return !data.empty() || closed; });
+            pop_bulk(res, maxN); // pop nothing if closed and drained
+        }
+        std::move(res.begin(), res.end(), out);
+        return res.size();
+    }
     bool try_pop(T& value)
     {
         std::lock_guard lg(mut);
@@ -52,21 +123,60 @@ public:
         data.pop();
         return res;
     }
-    void wait_and_pop(T& value)
+    // return false if queue is closed and drained.
+    bool wait_and_pop(T& value)
     {
         std::unique_lock ul(mut);
-        cond.wait(ul, [this] { return !data.empty(); });
+        cond.wait(ul, [this] { return !data.empty() || closed; });
+        if (data.empty())
+        {
+            return false;
+        }
         value = std::move(*data.front());
         data.pop();
+        return true;
     }
+    // return empty shared_ptr if queue is closed and drained.
     std::shared_ptr<T> wait_and_pop()
     {
         std::unique_lock ul(mut);
-        cond.wait(ul, [this] { return !data.empty(); });
+        cond.wait(ul, [this] { return !data.empty() || closed; });
+        if (data.empty())
+        {
+            return std::shared_ptr<T>();
+        }
         std::shared_ptr<T> res = data.front();
         data.pop();
         return res;
     }
+    // return empty shared_ptr if timeout, or queue is closed and drained.
+    template<typename Rep, typename Period>
+    std::shared_ptr<T> wait_pop_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        std::unique_lock ul(mut);
+        if (!cond.wait_for(ul, timeout, [this] { return !data.empty() || closed; }) || data.empty())
+        {
+            return std::shared_ptr<T>();
+        }
+        std::shared_ptr<T> res = data.front();
+        data.pop();
+        return res;
+    }
+    // called by producer after the last push, wake up all waiting consumers.
+    // after that, waiting pops return immediately with nothing once the queue is drained.
+    void close()
+    {
+        {
+            std::lock_guard lg(mut);
+            closed = true;
+        }
+        cond.notify_all();
+    }
+    bool drained() const
+    {
+        std::lock_guard lg(mut);
+        return closed && data.empty();
+    }
     bool empty() const
     {
         std::lock_guard lg(mut);
@@ -77,7 +187,6 @@ public:
 // application
 ThreadSafeQueue<double> Q;
 std::mutex mcout; // for cout
-std::atomic_flag end_of_produce { ATOMIC_FLAG_INIT };
 void producer()
 {
     for (int i = 0; i < 100; ++i)
@@ -89,28 +198,76 @@ void producer()
         }
         std::this_thread::sleep_for(10ms);
     }
-    end_of_produce.test_and_set();
+    Q.close();
 }
 void consumer()
 {
-    while (!end_of_produce.test())
+    while (auto sp = Q.wait_and_pop()) // block on condition variable until closed and drained, no polling.
+    {
+        std::lock_guard lg(mcout);
+        std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : comsumer : " << std::setw(2) << *sp << " -" << std::endl;
+    }
+}
+void timed_consumer()
+{
+    while (!Q.drained())
     {
-        if (auto sp = Q.try_pop())
+        if (auto sp = Q.wait_pop_for(15ms))
         {
             std::lock_guard lg(mcout);
-            std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : comsumer : " << std::setw(2) << *sp << " -" << std::endl;
+            std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : timed comsumer : " << std::setw(2) << *sp << " -" << std::endl;
         }
-        std::this_thread::sleep_for(20ms);
+    }
+}
+
+void bulk_producer(ThreadSafeQueue<double>& bulkQ)
+{
+    std::vector<double> batch(10);
+    for (int i = 0; i < 100; i += 10)
+    {
+        std::iota(batch.begin(), batch.end(), i);
+        bulkQ.push_range(batch.begin(), batch.end());
+        std::this_thread::sleep_for(10ms);
+    }
+    bulkQ.close();
+}
+void bulk_consumer(ThreadSafeQueue<double>& bulkQ)
+{
+    std::vector<std::shared_ptr<double>> values;
+    while (std::size_t count = bulkQ.wait_pop_bulk(std::back_inserter(values), 8))
+    {
+        std::lock_guard lg(mcout);
+        std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : bulk comsumer : " << std::setw(2) << count << " -" << std::endl;
     }
 }
 
 int main(int argc, char const *argv[])
 {
-    std::jthread tp(producer);
-    std::vector<std::jthread> consumers;
-    for (int i = 0; i < 10; ++i)
     {
-        consumers.emplace_back(consumer);
+        std::jthread tp(producer);
+        std::vector<std::jthread> consumers;
+        for (int i = 0; i < 5; ++i)
+        {
+            consumers.emplace_back(consumer);
+            consumers.emplace_back(timed_consumer);
+        }
+    }
+    std::cout << std::endl;
+    {
+        ThreadSafeQueue<double> bulkQ;
+        std::jthread tp(bulk_producer, std::ref(bulkQ));
+        std::jthread tc0(bulk_consumer, std::ref(bulkQ));
+        std::jthread tc1(bulk_consumer, std::ref(bulkQ));
+    }
+    {
+        ThreadSafeQueue<int> drainQ;
+        std::vector<std::shared_ptr<int>> values;
+        [[maybe_unused]] std::size_t count = drainQ.try_pop_bulk(std::back_inserter(values), std::numeric_limits<std::size_t>::max()); // drain everything
+        assert(count == 0);
+        const int input[] = { 1, 2, 3 };
+        drainQ.push_range(std::begin(input), std::end(input));
+        count = drainQ.try_pop_bulk(std::back_inserter(values), std::numeric_limits<std::size_t>::max());
+        assert(count == 3 && values.size() == 3);
     }
     return 0;
 }
@@ -0,0 +1,190 @@
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <optional>
+#include <type_traits>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// value semantics thread safe queue: elements are stored in std::deque<T> (a chunked array) directly,
+// no control block and no separate heap object per element.
+// P185 boxes elements into std::shared_ptr<T> so that returning a value can never throw after the element is removed.
+// Here the same guarantee comes from requiring T to be nothrow move constructible:
+// moving the front element into the returned std::optional<T> can not throw, so an element is never lost.
+template<typename T>
+class ThreadSafeQueue
+{
+    static_assert(std::is_nothrow_move_constructible_v<T>, "T must be nothrow move constructible");
+private:
+    mutable std::mutex mut;
+    std::deque<T> data;
+    std::condition_variable cond;
+public:
+    ThreadSafeQueue()
+    {
+    }
+    ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue&) = delete;
+    void push(T value)
+    {
+        {
+            std::lock_guard lg(mut);
+            data.push_back(std::move(value)); // if allocation throws, queue is unchanged.
+        }
+        cond.notify_one();
+    }
+    template<typename... Args>
+    void emplace(Args&&... args)
+    {
+        {
+            std::lock_guard lg(mut);
+            data.emplace_back(std::forward<Args>(args)...);
+        }
+        cond.notify_one();
+    }
+    std::optional<T> tryPop()
+    {
+        std::lock_guard lg(mut);
+        if (data.empty())
+        {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(data.front())); // nothrow
+        data.pop_front();
+        return res;
+    }
+    std::optional<T> waitAndPop()
+    {
+        std::unique_lock ul(mut);
+        cond.wait(ul, [this] { return !data.empty(); });
+        std::optional<T> res(std::move(data.front())); // nothrow
+        data.pop_front();
+        return res;
+    }
+    bool empty() const
+    {
+        std::lock_guard lg(mut);
+        return data.empty();
+    }
+};
+
+// from P185.ThreadSafeQueue.cpp, for comparison
+template<typename T>
+class PtrThreadSafeQueue
+{
+private:
+    mutable std::mutex mut;
+    std::queue<std::shared_ptr<T>> data;
+    std::condition_variable cond;
+public:
+    PtrThreadSafeQueue()
+    {
+    }
+    PtrThreadSafeQueue(const PtrThreadSafeQueue& other) = delete;
+    PtrThreadSafeQueue& operator=(const PtrThreadSafeQueue&) = delete;
+    void push(T value)
+    {
+        std::shared_ptr<T> newValuePtr = std::make_shared<T>(std::move(value));
+        std::lock_guard lg(mut);
+        data.push(newValuePtr);
+        cond.notify_one();
+    }
+    std::shared_ptr<T> try_pop()
+    {
+        std::lock_guard lg(mut);
+        if (data.empty())
+        {
+            return std::shared_ptr<T>(); // empty shared_ptr
+        }
+        std::shared_ptr<T> res = data.front();
+        data.pop();
+        return res;
+    }
+    std::shared_ptr<T> wait_and_pop()
+    {
+        std::unique_lock ul(mut);
+        cond.wait(ul, [this] { return !data.empty(); });
+        std::shared_ptr<T> res = data.front();
+        data.pop();
+        return res;
+    }
+    bool empty() const
+    {
+        std::lock_guard lg(mut);
+        return data.empty();
+    }
+};
+
+// benchmark: small trivially copyable payload
+template<typename Queue, typename PopFunc>
+void benchmark(const char* name, int threadPairs, int countPerThread, PopFunc pop)
+{
+    Queue Q;
+    std::atomic<long long> sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadPairs; ++i)
+        {
+            threads.emplace_back([&Q, countPerThread]() {
+                for (int j = 0; j < countPerThread; ++j)
+                {
+                    Q.push(j);
+                }
+            });
+            threads.emplace_back([&Q, &sum, &pop, countPerThread]() {
+                long long localSum = 0;
+                for (int j = 0; j < countPerThread; ++j)
+                {
+                    localSum += static_cast<long long>(pop(Q));
+                }
+                sum += localSum;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    assert(sum == threadPairs * (countPerThread - 1LL) * countPerThread / 2);
+    assert(Q.empty());
+    std::cout << std::setw(12) << name << " : " << threadPairs << " producers, " << threadPairs << " consumers, "
+        << threadPairs * countPerThread << " doubles : " << duration.count() << "ms" << std::endl;
+}
+
+std::mutex mcout; // for cout
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeQueue<std::unique_ptr<int>> Q; // move-only type works too
+    {
+        std::jthread producer([&Q]() {
+            for (int i = 0; i < 10; ++i)
+            {
+                Q.push(std::make_unique<int>(i));
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+        std::jthread consumer([&Q]() {
+            for (int i = 0; i < 10; ++i)
+            {
+                std::optional<std::unique_ptr<int>> value = Q.waitAndPop();
+                std::lock_guard lg(mcout);
+                std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : consumer : " << std::setw(2) << **value << " -" << std::endl;
+            }
+        });
+    }
+    assert(!Q.tryPop());
+
+    for (int pairs : { 1, 2, 4 })
+    {
+        benchmark<PtrThreadSafeQueue<double>>("shared_ptr", pairs, 200000, [](auto& q) { return *q.wait_and_pop(); });
+        benchmark<ThreadSafeQueue<double>>("value", pairs, 200000, [](auto& q) { return *q.waitAndPop(); });
+    }
+    return 0;
+}
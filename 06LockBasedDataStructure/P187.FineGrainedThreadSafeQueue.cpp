@@ -8,6 +8,9 @@
 #include <chrono>
 #include <memory>
 #include <cassert>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
 using namespace std::chrono_literals;
 
 template<typename T>
@@ -52,6 +55,34 @@ private:
         value = std::move(*head->data); // if throw exception here, no data will be removed.
         return popHead();
     }
+    // detach at most maxN nodes from head as a chain, headMutex must be locked, return count of detached nodes.
+    std::size_t popHeadBulk(std::unique_ptr<node>& chain, std::size_t maxN)
+    {
+        node* const oldTail = getTail(); // read tail only once
+        node* last = nullptr;
+        std::size_t count = 0;
+        for (node* p = head.get(); p != oldTail && count < maxN; p = p->next.get())
+        {
+            last = p;
+            ++count;
+        }
+        if (count > 0)
+        {
+            chain = std::move(head);
+            head = std::move(last->next);
+        }
+        return count;
+    }
+    // write data of chain to out and free nodes iteratively (avoid recursive destruction of a long chain).
+    template<typename OutputIt>
+    static void consumeChain(std::unique_ptr<node> chain, OutputIt out)
+    {
+        while (chain)
+        {
+            *out++ = std::move(chain->data);
+            chain = std::move(chain->next);
+        }
+    }
     std::unique_ptr<node> tryPopHead()
     {
         std::lock_guard headLock(headMutex);
@@ -107,6 +138,67 @@ public:
         }
         dataCond.notify_one();
     }
+    // push [first, last) with one tail lock: the chain of nodes is built out of lock, and linked to tail at once.
+    template<typename InputIt>
+    void pushRange(InputIt first, InputIt last)
+    {
+        if (first == last)
+        {
+            return;
+        }
+        // data of first element goes to current tail (dummy node), others go to new nodes, the last new node is the new dummy node.
+        std::shared_ptr<T> firstData = std::make_shared<T>(*first);
+        std::unique_ptr<node> chain = std::make_unique<node>();
+        node* newTail = chain.get();
+        std::size_t count = 1;
+        for (++first; first != last; ++first, ++count)
+        {
+            newTail->data = std::make_shared<T>(*first);
+            newTail->next = std::make_unique<node>();
+            newTail = newTail->next.get();
+        }
+        {
+            std::lock_guard tailLock(tailMutex);
+            tail->data = std::move(firstData);
+            tail->next = std::move(chain);
+            tail = newTail;
+        }
+        if (count == 1)
+        {
+            dataCond.notify_one();
+        }
+        else
+        {
+            dataCond.notify_all();
+        }
+    }
+    // pop at most maxN elements with one head lock, write them to out (as std::shared_ptr<T>), return count of popped elements.
+    // the nodes are detached before writing to out, so assigning to out should not throw (e.g. reserve the vector of back_inserter).
+    template<typename OutputIt>
+    std::size_t tryPopBulk(OutputIt out, std::size_t maxN)
+    {
+        std::unique_ptr<node> chain;
+        std::size_t count = 0;
+        {
+            std::lock_guard headLock(headMutex);
+            count = popHeadBulk(chain, maxN);
+        }
+        consumeChain(std::move(chain), out);
+        return count;
+    }
+    // wait until at least one element is available, then pop at most maxN elements.
+    template<typename OutputIt>
+    std::size_t waitPopBulk(OutputIt out, std::size_t maxN)
+    {
+        std::unique_ptr<node> chain;
+        std::size_t count = 0;
+        {
+            std::unique_lock<std::mutex> headLock(waitForData());
+            count = popHeadBulk(chain, maxN);
+        }
+        consumeChain(std::move(chain), out);
+        return count;
+    }
     bool empty() const
     {
         std::lock_guard headLock(headMutex);
@@ -184,6 +276,29 @@ void consumer3()
     }
 }
 
+void bulkProducer(ThreadSafeQueue<double>& bulkQ)
+{
+    std::vector<double> batch(10);
+    for (int i = 0; i < 100; i += 10)
+    {
+        std::iota(batch.begin(), batch.end(), i);
+        bulkQ.pushRange(batch.begin(), batch.end());
+        std::this_thread::sleep_for(10ms);
+    }
+}
+
+void bulkConsumer(ThreadSafeQueue<double>& bulkQ)
+{
+    std::vector<std::shared_ptr<double>> values;
+    values.reserve(50);
+    while (values.size() < 50)
+    {
+        std::size_t count = bulkQ.waitPopBulk(std::back_inserter(values), std::min<std::size_t>(8, 50 - values.size()));
+        std::lock_guard lg(mcout);
+        std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : bulk consumer : " << std::setw(2) << count << " -" << std::endl;
+    }
+}
+
 int main(int argc, char const *argv[])
 {
     {
@@ -206,5 +321,12 @@ int main(int argc, char const *argv[])
             std::jthread(consumer3).detach();
         }
     }
+    std::cout << std::endl;
+    {
+        ThreadSafeQueue<double> bulkQ; // detached consumers above may still be waiting on Q
+        std::jthread tp(bulkProducer, std::ref(bulkQ));
+        std::jthread tc0(bulkConsumer, std::ref(bulkQ));
+        std::jthread tc1(bulkConsumer, std::ref(bulkQ));
+    }
     return 0;
 }
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <condition_variable>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// based on P187.FineGrainedThreadSafeQueue.cpp
+// 1. popped nodes are not freed but recycled into a free list, push takes nodes from it,
+//    so steady-state push/pop does not touch the allocator.
+//    producers and consumers do not share a lock per operation, which the two-lock design exists to avoid:
+//    consumers recycle into their own list, producers take from theirs, and a producer whose list is empty
+//    takes the whole consumer list at once, so the two sides meet once per batch of nodes.
+// 2. StoreInline = true stores T inside the node (std::optional<T>) instead of std::shared_ptr<T>,
+//    which saves the second allocation of make_shared.
+template<typename T, bool StoreInline = false>
+class ThreadSafeQueue
+{
+public:
+    using ValuePtr = std::conditional_t<StoreInline, std::optional<T>, std::shared_ptr<T>>;
+private:
+    struct node
+    {
+        ValuePtr data;
+        struct std::unique_ptr<node> next;
+    };
+    std::mutex headMutex;
+    std::unique_ptr<node> head;
+    std::mutex tailMutex;
+    node* tail;
+    std::condition_variable dataCond;
+    std::atomic<int> waitingConsumers; // consumers which may be about to wait on dataCond
+    // free lists, each mutex only protects a few pointer operations
+    std::mutex producerFreeMutex; // taken by producers only
+    std::unique_ptr<node> producerFreeList;
+    std::mutex consumerFreeMutex; // taken by consumers, and by a producer once per batch
+    std::unique_ptr<node> consumerFreeList;
+    std::atomic<std::size_t> consumerFreeCount; // changed under consumerFreeMutex, read without it as a hint
+    const std::size_t maxFreeCount; // upper bound of nodes cached by consumers, extra nodes will be freed.
+    static ValuePtr makeValue(T&& value)
+    {
+        if constexpr (StoreInline)
+        {
+            return ValuePtr(std::move(value));
+        }
+        else
+        {
+            return std::make_shared<T>(std::move(value));
+        }
+    }
+    std::unique_ptr<node> allocNode()
+    {
+        {
+            std::lock_guard freeLock(producerFreeMutex);
+            // refill with everything consumers have recycled, skip their lock when there is nothing to take
+            if (!producerFreeList && consumerFreeCount.load(std::memory_order_relaxed) > 0)
+            {
+                std::lock_guard consumerLock(consumerFreeMutex);
+                producerFreeList = std::move(consumerFreeList);
+                consumerFreeCount.store(0, std::memory_order_relaxed);
+            }
+            if (producerFreeList)
+            {
+                std::unique_ptr<node> p = std::move(producerFreeList);
+                producerFreeList = std::move(p->next);
+                return p;
+            }
+        }
+        return std::make_unique<node>();
+    }
+    void recycleNode(std::unique_ptr<node> p)
+    {
+        p->data = ValuePtr(); // destroy data out of lock
+        std::lock_guard freeLock(consumerFreeMutex);
+        const std::size_t count = consumerFreeCount.load(std::memory_order_relaxed);
+        if (count < maxFreeCount)
+        {
+            p->next = std::move(consumerFreeList);
+            consumerFreeList = std::move(p);
+            consumerFreeCount.store(count + 1, std::memory_order_relaxed);
+        }
+    }
+    node* getTail()
+    {
+        std::lock_guard tailLock(tailMutex);
+        return tail;
+    }
+    std::unique_ptr<node> popHead()
+    {
+        std::unique_ptr<node> oldHead = std::move(head);
+        head = std::move(oldHead->next);
+        return oldHead;
+    }
+    std::unique_lock<std::mutex> waitForData()
+    {
+        std::unique_lock<std::mutex> headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            waitingConsumers.fetch_add(1); // before the predicate reads tail again, see push
+            dataCond.wait(headLock, [&]() -> bool { return head.get() != getTail(); });
+            waitingConsumers.fetch_sub(1);
+        }
+        return headLock;
+    }
+    std::unique_ptr<node> waitPopHead()
+    {
+        std::unique_lock<std::mutex> headLock(waitForData());
+        return popHead();
+    }
+    std::unique_ptr<node> waitPopHead(T& value)
+    {
+        std::unique_lock<std::mutex> headLock(waitForData());
+        value = std::move(*head->data); // if throw exception here, no data will be removed.
+        return popHead();
+    }
+    std::unique_ptr<node> tryPopHead()
+    {
+        std::lock_guard headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            return std::unique_ptr<node>();
+        }
+        return popHead();
+    }
+    std::unique_ptr<node> tryPopHead(T& value)
+    {
+        std::lock_guard headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            return std::unique_ptr<node>();
+        }
+        value = std::move(*head->data); // if throw exception here, no data will be removed.
+        return popHead();
+    }
+public:
+    ThreadSafeQueue(std::size_t maxFreeNodes = 1024)
+        : head(std::make_unique<node>())
+        , tail(head.get())
+        , waitingConsumers(0)
+        , consumerFreeCount(0)
+        , maxFreeCount(maxFreeNodes)
+    {
+    }
+    ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue& other) = delete;
+    ValuePtr tryPop()
+    {
+        std::unique_ptr<node> oldHead = tryPopHead();
+        if (!oldHead)
+        {
+            return ValuePtr();
+        }
+        ValuePtr res = std::move(oldHead->data);
+        recycleNode(std::move(oldHead));
+        return res;
+    }
+    bool tryPop(T& value)
+    {
+        std::unique_ptr<node> oldHead = tryPopHead(value);
+        if (!oldHead)
+        {
+            return false;
+        }
+        recycleNode(std::move(oldHead));
+        return true;
+    }
+    ValuePtr waitAndPop()
+    {
+        std::unique_ptr<node> oldHead = waitPopHead();
+        ValuePtr res = std::move(oldHead->data);
+        recycleNode(std::move(oldHead));
+        return res;
+    }
+    void waitAndPop(T& value)
+    {
+        recycleNode(waitPopHead(value));
+    }
+    void push(T value)
+    {
+        ValuePtr newData = makeValue(std::move(value));
+        std::unique_ptr<node> p = allocNode();
+        node* newTail = p.get();
+        {
+            std::lock_guard tailLock(tailMutex); // minimize the critical section
+            tail->data = std::move(newData);
+            tail->next = std::move(p);
+            tail = newTail;
+        }
+        // a consumer which has read the old tail may not be waiting yet, and would miss the notification.
+        // it holds headMutex until it waits, so taking headMutex once makes sure it is waiting.
+        // producers only do this while some consumer waits, otherwise they never touch headMutex.
+        if (waitingConsumers.load() > 0)
+        {
+            std::lock_guard headLock(headMutex);
+        }
+        dataCond.notify_one();
+    }
+    bool empty()
+    {
+        std::lock_guard headLock(headMutex);
+        return head.get() == getTail();
+    }
+};
+
+// application
+std::mutex mcout; // for cout
+
+template<bool StoreInline>
+void churn(const char* name, int threadPairs, int countPerThread)
+{
+    ThreadSafeQueue<double, StoreInline> Q;
+    std::atomic<double> sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadPairs; ++i)
+        {
+            threads.emplace_back([&Q, countPerThread]() {
+                for (int j = 0; j < countPerThread; ++j)
+                {
+                    Q.push(j);
+                }
+            });
+            threads.emplace_back([&Q, &sum, countPerThread]() {
+                double localSum = 0;
+                for (int j = 0; j < countPerThread; ++j)
+                {
+                    localSum += *Q.waitAndPop();
+                }
+                sum += localSum;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    assert(sum == threadPairs * (countPerThread - 1.0) * countPerThread / 2);
+    assert(Q.empty());
+    std::cout << std::setw(10) << name << " : " << threadPairs << " producers, " << threadPairs << " consumers, "
+        << threadPairs * countPerThread << " items : " << duration.count() << "ms" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeQueue<std::string, true> Q;
+    auto producer = [&Q]() {
+        for (int i = 0; i < 20; ++i)
+        {
+            Q.push(std::to_string(i));
+            std::this_thread::sleep_for(1ms);
+        }
+    };
+    auto consumer = [&Q]() {
+        for (int i = 0; i < 10; ++i)
+        {
+            std::optional<std::string> value = Q.waitAndPop();
+            std::lock_guard lg(mcout);
+            std::cout << "thread " << std::setw(2) << std::this_thread::get_id() << " : consumer : " << std::setw(2) << *value << " -" << std::endl;
+        }
+    };
+    {
+        std::jthread tp(producer);
+        std::jthread tc0(consumer);
+        std::jthread tc1(consumer);
+    }
+    assert(Q.empty());
+
+    // steady-state push/pop, nodes are recycled after warm up.
+    for (int pairs : { 1, 2, 4 })
+    {
+        churn<false>("shared_ptr", pairs, 200000);
+        churn<true>("inline", pairs, 200000);
+    }
+    return 0;
+}
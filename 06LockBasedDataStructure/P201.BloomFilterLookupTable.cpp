@@ -0,0 +1,390 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <random>
+#include <optional>
+#include <cstdint>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// counting blocked bloom filter.
+// every key maps to one cache line holding 128 4-bit counters and increments k of them, so a query reads one cache line.
+// counters (instead of bits) make removal possible, a counter reaching 15 sticks there and is never decremented.
+// counters are changed with relaxed CAS, queries only load.
+class CountingBloomFilter
+{
+private:
+    static constexpr std::size_t wordsPerBlock = 8;
+    static constexpr std::size_t countersPerWord = 16;
+    static constexpr std::size_t countersPerKey = 6; // k
+    static constexpr std::uint64_t maxCount = 15;
+    struct alignas(64) Block
+    {
+        std::atomic<std::uint64_t> words[wordsPerBlock];
+    };
+    std::vector<Block> m_blocks;
+    static std::uint64_t mix(std::uint64_t h) // murmur3 finalizer, std::hash of integers is identity
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    std::size_t blockIndex(std::uint64_t h) const
+    {
+        // high 32 bits select the block, counters are taken from a second mix
+        return ((h >> 32) * m_blocks.size()) >> 32;
+    }
+    template<typename Func>
+    static void forEachCounter(std::uint64_t h, Func func)
+    {
+        const std::uint64_t bits = mix(h ^ 0x9e3779b97f4a7c15ULL);
+        for (std::size_t i = 0; i < countersPerKey; ++i)
+        {
+            const std::size_t index = (bits >> (7 * i)) & 127;
+            func(index / countersPerWord, (index % countersPerWord) * 4);
+        }
+    }
+    template<int Delta>
+    void modify(std::size_t hash)
+    {
+        const std::uint64_t h = mix(hash);
+        Block& block = m_blocks[blockIndex(h)];
+        forEachCounter(h, [&block](std::size_t word, std::size_t shift) {
+            std::uint64_t old = block.words[word].load(std::memory_order_relaxed);
+            while (true)
+            {
+                const std::uint64_t count = (old >> shift) & maxCount;
+                if (count == maxCount || (Delta < 0 && count == 0)) // saturated, keep it forever
+                {
+                    return;
+                }
+                const std::uint64_t desired = Delta > 0 ? old + (std::uint64_t(1) << shift) : old - (std::uint64_t(1) << shift);
+                if (block.words[word].compare_exchange_weak(old, desired, std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+        });
+    }
+public:
+    // about 12 counters (6 bytes) per expected key, false positive rate around 1%
+    explicit CountingBloomFilter(std::size_t expectedCount)
+        : m_blocks(std::max<std::size_t>(1, expectedCount * 12 / (wordsPerBlock * countersPerWord)))
+    {
+    }
+    void add(std::size_t hash)
+    {
+        modify<1>(hash);
+    }
+    void remove(std::size_t hash)
+    {
+        modify<-1>(hash);
+    }
+    bool mayContain(std::size_t hash) const
+    {
+        const std::uint64_t h = mix(hash);
+        const Block& block = m_blocks[blockIndex(h)];
+        bool res = true;
+        forEachCounter(h, [&](std::size_t word, std::size_t shift) {
+            res = res && ((block.words[word].load(std::memory_order_relaxed) >> shift) & maxCount) != 0;
+        });
+        return res;
+    }
+    std::size_t memoryUsage() const
+    {
+        return m_blocks.size() * sizeof(Block);
+    }
+};
+
+// P201.ThreadSafeLookupTable.cpp with an optional counting bloom filter in front of the buckets.
+// valueFor asks the filter first without any lock, a key the filter has never seen returns the default at once.
+// the filter is changed under the bucket lock: a key is added before it becomes visible in the bucket,
+// and removed after it is erased, so the filter never says no for a key in the table.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        using BucketIterator = typename BucketData::iterator;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        // empty if the key is not found, Value need not be default constructible
+        std::optional<Value> valueFor(const Key& key) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex); // lock on shared mode.
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                return std::nullopt;
+            }
+            return foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value, CountingBloomFilter* filter, std::size_t hash)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end()) // not found, insert
+            {
+                if (filter)
+                {
+                    filter->add(hash);
+                }
+                m_data.emplace_back(key, value);
+            }
+            else // found, modify
+            {
+                foundEntry->second = value;
+            }
+        }
+        void removeMapping(const Key& key, CountingBloomFilter* filter, std::size_t hash)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry != m_data.end()) // found
+            {
+                m_data.erase(foundEntry);
+                if (filter)
+                {
+                    filter->remove(hash);
+                }
+            }
+        }
+    };
+    // lookup counters, one cache line per thread slot so that filtered lookups do not share a written line.
+    // each lookup bumps exactly one of them with a relaxed load and store instead of a locked read-modify-write,
+    // lookups is their sum. threads sharing a slot may lose an increment, the counts are statistics only.
+    struct alignas(64) StatCounters
+    {
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> filtered{0}; // rejected by the filter without locking
+        std::atomic<std::uint64_t> falsePositives{0}; // passed the filter but not found
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    std::unique_ptr<CountingBloomFilter> m_filter;
+    mutable std::vector<StatCounters> m_stats;
+    BucketType& getBucket(std::size_t hash) const
+    {
+        return *m_buckets[hash % m_buckets.size()];
+    }
+    StatCounters& localStats() const
+    {
+        static std::atomic<std::size_t> nextSlot{0};
+        thread_local const std::size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+        return m_stats[slot % m_stats.size()];
+    }
+    static void bump(std::atomic<std::uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    struct Stats
+    {
+        std::uint64_t lookups;
+        std::uint64_t filtered;
+        std::uint64_t falsePositives;
+        // fraction of misses that were not caught by the filter and had to lock a bucket
+        double falsePositiveRate() const
+        {
+            return filtered + falsePositives == 0 ? 0.0 : double(falsePositives) / double(filtered + falsePositives);
+        }
+    };
+    // numBuckets better be prime number, expectedCount = 0 means no filter
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, std::size_t expectedCount = 0, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+        , m_filter(expectedCount > 0 ? std::make_unique<CountingBloomFilter>(expectedCount) : nullptr)
+        , m_stats(std::max(1u, std::thread::hardware_concurrency()) * 2)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        const std::size_t hash = m_hasher(key);
+        StatCounters& stats = localStats();
+        if (m_filter && !m_filter->mayContain(hash))
+        {
+            bump(stats.filtered);
+            return defaultValue;
+        }
+        std::optional<Value> found = getBucket(hash).valueFor(key);
+        if (!found)
+        {
+            bump(stats.falsePositives);
+            return defaultValue;
+        }
+        bump(stats.hits);
+        return std::move(*found);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).addOrUpdateMapping(key, value, m_filter.get(), hash);
+    }
+    void removeMapping(const Key& key)
+    {
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).removeMapping(key, m_filter.get(), hash);
+    }
+    Stats stats() const
+    {
+        Stats res{0, 0, 0};
+        for (const auto& counters : m_stats)
+        {
+            res.filtered += counters.filtered.load(std::memory_order_relaxed);
+            res.falsePositives += counters.falsePositives.load(std::memory_order_relaxed);
+            res.lookups += counters.hits.load(std::memory_order_relaxed);
+        }
+        res.lookups += res.filtered + res.falsePositives;
+        return res;
+    }
+    std::size_t filterMemoryUsage() const
+    {
+        return m_filter ? m_filter->memoryUsage() : 0;
+    }
+    // get a snapshot of lookup table
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (const auto& bucket : m_buckets)
+        {
+            res.insert(bucket->m_data.begin(), bucket->m_data.end());
+        }
+        return res;
+    }
+};
+
+// 70% of lookups miss, with and without the filter
+void benchmarkMissHeavy(std::size_t expectedCount, int threadCount)
+{
+    const int count = 1 << 20;
+    const int lookupsPerThread = 1 << 21;
+    ThreadSafeLookupTable<int, int> table(count / 4 * 2 + 1, expectedCount); // about 2 entries per bucket
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i * 2, i); // even keys are present
+    }
+    std::atomic<long long> found{0};
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> vec;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            vec.emplace_back([&, t]() {
+                std::mt19937 gen(t);
+                std::uniform_int_distribution<int> dist(0, count - 1);
+                long long localFound = 0;
+                for (int i = 0; i < lookupsPerThread; ++i)
+                {
+                    const int key = dist(gen) * 2 + (i % 10 < 7 ? 1 : 0); // odd keys are absent
+                    localFound += table.valueFor(key, -1) >= 0 ? 1 : 0;
+                }
+                found += localFound;
+            });
+        }
+    }
+    auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    auto stats = table.stats();
+    std::cout << (expectedCount ? "with filter    " : "without filter ") << threadCount << " threads : " << std::setw(5) << dur
+        << "ms, found " << found << ", false positive rate " << std::fixed << std::setprecision(4) << stats.falsePositiveRate()
+        << ", filter " << table.filterMemoryUsage() / 1024 << "KB" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103, 1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+        table.addOrUpdateMapping(i, std::to_string(i) + "_copy"); // update does not touch the filter
+    }
+    auto lookupFunc = [&table](int count) {
+        for (int i = 0; i < 100; ++i)
+        {
+            [[maybe_unused]] std::string value = table.valueFor(count * 100 + i);
+            assert(value == std::to_string(count * 100 + i) + "_copy");
+            [[maybe_unused]] std::string missing = table.valueFor(1000 + count * 100 + i, "none");
+            assert(missing == "none");
+        }
+    };
+    {
+        std::vector<std::jthread> vec;
+        for (int i = 0; i < 10; ++i)
+        {
+            vec.emplace_back(lookupFunc, i);
+        }
+    }
+    for (int i = 0; i < 1000; i += 2)
+    {
+        table.removeMapping(i);
+    }
+    for (int i = 0; i < 1000; ++i) // removed keys are gone, the remaining ones are still found
+    {
+        [[maybe_unused]] std::string value = table.valueFor(i, "none");
+        assert(value == (i % 2 == 0 ? "none" : std::to_string(i) + "_copy"));
+    }
+    auto stats = table.stats();
+    std::cout << "lookups " << stats.lookups << ", filtered " << stats.filtered << ", false positives " << stats.falsePositives
+        << ", false positive rate " << stats.falsePositiveRate() << std::endl;
+    assert(stats.falsePositiveRate() < 0.1);
+    assert(stats.lookups == 10 * 200 + 1000);
+
+    // values without a default constructor, valueFor only copies a found value or the given default
+    struct Id
+    {
+        explicit Id(int i) : value(i) {}
+        int value;
+    };
+    ThreadSafeLookupTable<int, Id> ids(7, 16);
+    ids.addOrUpdateMapping(1, Id(10));
+    assert(ids.valueFor(1, Id(-1)).value == 10);
+    assert(ids.valueFor(2, Id(-1)).value == -1);
+
+    const int threadCount = 4;
+    benchmarkMissHeavy(0, threadCount);
+    benchmarkMissHeavy(1 << 20, threadCount);
+    return 0;
+}
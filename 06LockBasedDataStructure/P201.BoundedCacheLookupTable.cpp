@@ -0,0 +1,391 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// lookup table used as a memoization cache with bounded capacity, based on P201.ThreadSafeLookupTable.cpp.
+// every bucket is a shard holding at most capacity / numBuckets entries, evicted by CLOCK (an approximation of LRU):
+// - entries of a shard live in a ring of slots, each slot has a reference bit.
+// - a hit only sets the reference bit (if it is not set yet) under the shared lock, hits never take exclusive lock.
+//   exact LRU has to move the entry to the front of a list on every hit, which is a write needing exclusive lock.
+// - inserting into a full shard moves the clock hand: a slot with reference bit set gets a second chance
+//   (bit cleared), the first slot without it is evicted. entries not used since the last sweep go first.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class BoundedLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class BoundedLookupTable<Key, Value, Hash>;
+    private:
+        struct Slot
+        {
+            std::optional<std::pair<Key, Value>> entry;
+            mutable std::atomic<bool> referenced { false };
+        };
+        const std::size_t m_capacity;
+        std::unique_ptr<Slot[]> m_slots;
+        std::size_t m_used; // slots [0, m_used) have been filled once
+        std::vector<std::size_t> m_freeSlots; // slots emptied by removeMapping, reused before evicting
+        std::size_t m_hand;
+        std::unordered_map<Key, std::size_t, Hash> m_index; // key -> slot
+        mutable std::shared_mutex m_mutex;
+        mutable std::atomic<std::uint64_t> m_hits;
+        mutable std::atomic<std::uint64_t> m_misses;
+        std::atomic<std::uint64_t> m_evictions;
+        // slot for a new entry, evict one if the shard is full. caller holds the exclusive lock.
+        std::size_t freeSlot()
+        {
+            if (!m_freeSlots.empty())
+            {
+                const std::size_t i = m_freeSlots.back();
+                m_freeSlots.pop_back();
+                return i;
+            }
+            if (m_used < m_capacity)
+            {
+                return m_used++;
+            }
+            for (;; m_hand = (m_hand + 1) % m_capacity)
+            {
+                Slot& slot = m_slots[m_hand];
+                if (slot.referenced.load(std::memory_order_relaxed)) // second chance
+                {
+                    slot.referenced.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                const std::size_t victim = m_hand;
+                m_hand = (m_hand + 1) % m_capacity;
+                assert(slot.entry); // no free slots, so the shard is full
+                m_index.erase(slot.entry->first);
+                slot.entry.reset();
+                m_evictions.fetch_add(1, std::memory_order_relaxed);
+                return victim;
+            }
+        }
+        template<typename V>
+        void insert(const Key& key, V&& value)
+        {
+            const std::size_t i = freeSlot();
+            m_slots[i].entry.emplace(key, std::forward<V>(value));
+            m_slots[i].referenced.store(false, std::memory_order_relaxed); // must be hit once to survive a sweep
+            m_index.emplace(key, i);
+        }
+    public:
+        BucketType(std::size_t capacity, const Hash& hasher)
+            : m_capacity(capacity)
+            , m_slots(new Slot[capacity])
+            , m_used(0)
+            , m_hand(0)
+            , m_index(capacity, hasher)
+            , m_hits(0)
+            , m_misses(0)
+            , m_evictions(0)
+        {
+        }
+        std::optional<Value> tryGet(const Key& key) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto iter = m_index.find(key);
+            if (iter == m_index.end())
+            {
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+            const Slot& slot = m_slots[iter->second];
+            if (!slot.referenced.load(std::memory_order_relaxed)) // avoid writing the cache line when the bit is set
+            {
+                slot.referenced.store(true, std::memory_order_relaxed);
+            }
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return slot.entry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto iter = m_index.find(key);
+            if (iter == m_index.end())
+            {
+                insert(key, value);
+            }
+            else
+            {
+                m_slots[iter->second].entry->second = value;
+            }
+        }
+        // insert value only if key is not present (another thread may have computed it meanwhile), return the cached value.
+        Value addIfAbsent(const Key& key, Value&& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto iter = m_index.find(key);
+            if (iter != m_index.end())
+            {
+                return m_slots[iter->second].entry->second;
+            }
+            insert(key, value);
+            return std::move(value);
+        }
+        void removeMapping(const Key& key)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto iter = m_index.find(key);
+            if (iter != m_index.end())
+            {
+                // the next insert takes the slot from the free list instead of evicting a live entry
+                Slot& slot = m_slots[iter->second];
+                slot.entry.reset();
+                slot.referenced.store(false, std::memory_order_relaxed);
+                m_freeSlots.push_back(iter->second);
+                m_index.erase(iter);
+            }
+        }
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    std::size_t m_capacity;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    struct Stats
+    {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+        double hitRate() const
+        {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+        }
+    };
+    // at most capacity entries, the first capacity % numBuckets shards hold one more entry than the others.
+    // there are never more shards than capacity, so every shard holds at least one entry.
+    BoundedLookupTable(std::size_t capacity, std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(std::min(numBuckets, std::max<std::size_t>(capacity, 1)))
+        , m_hasher(hasher)
+        , m_capacity(std::max<std::size_t>(capacity, 1))
+    {
+        const std::size_t shardCount = m_buckets.size();
+        for (std::size_t i = 0; i < shardCount; ++i)
+        {
+            m_buckets[i].reset(new BucketType(m_capacity / shardCount + (i < m_capacity % shardCount ? 1 : 0), hasher));
+        }
+    }
+    BoundedLookupTable(const BoundedLookupTable&) = delete;
+    BoundedLookupTable& operator=(const BoundedLookupTable&) = delete;
+    std::size_t capacity() const
+    {
+        return m_capacity;
+    }
+    std::optional<Value> tryGet(const Key& key) const
+    {
+        return getBucket(key).tryGet(key);
+    }
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return tryGet(key).value_or(defaultValue);
+    }
+    // memoization: return cached value, or compute factory() without holding any lock and cache it.
+    template<typename Factory>
+    Value getOrCompute(const Key& key, Factory&& factory)
+    {
+        BucketType& bucket = getBucket(key);
+        if (auto cached = bucket.tryGet(key))
+        {
+            return std::move(*cached);
+        }
+        return bucket.addIfAbsent(key, std::forward<Factory>(factory)());
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+    void removeMapping(const Key& key)
+    {
+        getBucket(key).removeMapping(key);
+    }
+    std::size_t size() const
+    {
+        std::size_t res = 0;
+        for (const auto& bucket : m_buckets)
+        {
+            std::shared_lock<std::shared_mutex> lock(bucket->m_mutex);
+            res += bucket->m_index.size();
+        }
+        return res;
+    }
+    Stats stats() const
+    {
+        Stats res { 0, 0, 0 };
+        for (const auto& bucket : m_buckets)
+        {
+            res.hits += bucket->m_hits.load(std::memory_order_relaxed);
+            res.misses += bucket->m_misses.load(std::memory_order_relaxed);
+            res.evictions += bucket->m_evictions.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+};
+
+// exact LRU cache for comparison: a hit moves the entry to the front of the list, so every access locks exclusively.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ExactLruCache
+{
+private:
+    std::mutex m_mutex;
+    std::list<std::pair<Key, Value>> m_list; // most recently used first
+    std::unordered_map<Key, typename std::list<std::pair<Key, Value>>::iterator, Hash> m_index;
+    const std::size_t m_capacity;
+    std::uint64_t m_hits;
+    std::uint64_t m_misses;
+public:
+    ExactLruCache(std::size_t capacity, std::size_t = 0) : m_capacity(capacity), m_hits(0), m_misses(0) {}
+    template<typename Factory>
+    Value getOrCompute(const Key& key, Factory&& factory)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto iter = m_index.find(key);
+            if (iter != m_index.end())
+            {
+                ++m_hits;
+                m_list.splice(m_list.begin(), m_list, iter->second);
+                return iter->second->second;
+            }
+            ++m_misses;
+        }
+        Value value = std::forward<Factory>(factory)();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_index.find(key) == m_index.end())
+        {
+            if (m_list.size() == m_capacity)
+            {
+                m_index.erase(m_list.back().first);
+                m_list.pop_back();
+            }
+            m_list.emplace_front(key, value);
+            m_index.emplace(key, m_list.begin());
+        }
+        return value;
+    }
+    double hitRate()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return static_cast<double>(m_hits) / static_cast<double>(m_hits + m_misses);
+    }
+};
+
+// keys follow a zipf distribution (s = 0.99) over keyCount keys, like typical cache workloads.
+class ZipfGenerator
+{
+    std::vector<double> m_cdf;
+    std::uint64_t m_state;
+public:
+    ZipfGenerator(std::size_t keyCount, std::uint64_t seed) : m_cdf(keyCount), m_state(seed)
+    {
+        double sum = 0;
+        for (std::size_t i = 0; i < keyCount; ++i)
+        {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), 0.99);
+            m_cdf[i] = sum;
+        }
+        for (auto& c : m_cdf)
+        {
+            c /= sum;
+        }
+    }
+    int operator()()
+    {
+        m_state ^= m_state << 13; // xorshift64
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        const double u = static_cast<double>(m_state >> 11) * (1.0 / 9007199254740992.0);
+        return static_cast<int>(std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin());
+    }
+};
+
+template<typename Cache>
+double benchmark(Cache& cache, int threadCount, int accessesPerThread, std::size_t keyCount)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                ZipfGenerator next(keyCount, 88172645463325252ull + t);
+                for (int i = 0; i < accessesPerThread; ++i)
+                {
+                    const int key = next();
+                    [[maybe_unused]] const int value = cache.getOrCompute(key, [key]() { return key * 2; });
+                    assert(value == key * 2);
+                }
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(accessesPerThread) * threadCount / duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    BoundedLookupTable<int, std::string> table(100, 7);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+        assert(table.size() <= table.capacity());
+    }
+    std::cout << "capacity " << table.capacity() << ", size " << table.size() << ", evictions " << table.stats().evictions << std::endl;
+    // a hot key survives while other keys stream through the cache
+    table.addOrUpdateMapping(-1, "hot");
+    for (int i = 1000; i < 2000; ++i)
+    {
+        [[maybe_unused]] std::string value = table.valueFor(-1);
+        assert(value == "hot");
+        table.addOrUpdateMapping(i, std::to_string(i));
+    }
+    table.removeMapping(1999);
+    assert(table.valueFor(1999, "none") == "none" && table.size() <= table.capacity() && table.capacity() == 100);
+    [[maybe_unused]] const auto evictions = table.stats().evictions;
+    table.addOrUpdateMapping(1999 + 7, "refill"); // same shard, takes the slot of 1999
+    assert(table.stats().evictions == evictions && table.valueFor(1999 + 7) == "refill");
+
+    const std::size_t keyCount = 1000000;
+    const std::size_t capacity = 50000;
+    const int accesses = 1000000;
+    std::cout << keyCount << " zipf keys, capacity " << capacity << std::endl;
+    for (int threadCount : { 1, 4 })
+    {
+        ExactLruCache<int, int> lru(capacity);
+        BoundedLookupTable<int, int> clock(capacity, 1031);
+        const double lruSpeed = benchmark(lru, threadCount, accesses, keyCount);
+        const double clockSpeed = benchmark(clock, threadCount, accesses, keyCount);
+        const auto stats = clock.stats();
+        std::cout << threadCount << " threads : exact LRU hit rate " << std::fixed << std::setprecision(4) << lru.hitRate()
+            << ", " << std::setprecision(2) << lruSpeed << " Mops/s; CLOCK hit rate " << std::setprecision(4) << stats.hitRate()
+            << ", " << std::setprecision(2) << clockSpeed << " Mops/s, " << stats.evictions << " evictions, size "
+            << clock.size() << std::endl;
+        assert(clock.size() <= capacity);
+    }
+    return 0;
+}
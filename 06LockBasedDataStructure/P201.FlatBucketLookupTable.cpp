@@ -0,0 +1,387 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// count bytes on heap, for memory footprint comparison
+std::atomic<std::size_t> heapBytes = 0;
+void* operator new(std::size_t size)
+{
+    // keep size in front of the block, so unsized delete can account it too
+    void* p = std::malloc(size + alignof(std::max_align_t));
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(p) = size;
+    heapBytes.fetch_add(size, std::memory_order_relaxed);
+    return static_cast<char*>(p) + alignof(std::max_align_t);
+}
+void operator delete(void* p) noexcept
+{
+    if (p)
+    {
+        void* block = static_cast<char*>(p) - alignof(std::max_align_t);
+        heapBytes.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+// lookup table with open addressing buckets:
+// every bucket (a lock stripe) is a small hash table with linear probing, which stores
+// - an array of 1 byte tags: empty, deleted, or 0x80 | 7 bits of hash (fingerprint),
+// - an array of key value pairs.
+// a lookup scans the tags (64 tags in one cache line) and compares the key only when the fingerprint matches,
+// so it touches one cache line of tags and usually one of slots, instead of chasing a list node per entry.
+// a bucket grows by itself when it is more than 7/8 full, so numBuckets only decides the count of locks.
+// Key and Value should be default constructible.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        static constexpr std::uint8_t emptyTag = 0;
+        static constexpr std::uint8_t deletedTag = 1;
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+        std::vector<std::uint8_t> m_tags;
+        std::vector<BucketValue> m_slots;
+        std::size_t m_used; // occupied and deleted slots
+        mutable std::shared_mutex m_mutex;
+        static std::uint8_t tagOf(std::size_t hash)
+        {
+            return static_cast<std::uint8_t>(0x80 | (hash >> (sizeof(std::size_t) * 8 - 7)));
+        }
+        std::size_t findIndex(const Key& key, std::size_t hash) const
+        {
+            if (m_tags.empty())
+            {
+                return npos;
+            }
+            const std::size_t mask = m_tags.size() - 1;
+            const std::uint8_t tag = tagOf(hash);
+            for (std::size_t i = hash & mask; ; i = (i + 1) & mask)
+            {
+                if (m_tags[i] == emptyTag)
+                {
+                    return npos;
+                }
+                if (m_tags[i] == tag && m_slots[i].first == key)
+                {
+                    return i;
+                }
+            }
+        }
+        void rehash(std::size_t newCapacity, const Hash& hasher)
+        {
+            std::vector<std::uint8_t> oldTags(newCapacity, emptyTag);
+            std::vector<BucketValue> oldSlots(newCapacity);
+            oldTags.swap(m_tags);
+            oldSlots.swap(m_slots);
+            m_used = 0;
+            for (std::size_t i = 0; i < oldTags.size(); ++i)
+            {
+                if (oldTags[i] & 0x80)
+                {
+                    insertNew(std::move(oldSlots[i]), mix(hasher(oldSlots[i].first)));
+                }
+            }
+        }
+        void insertNew(BucketValue&& item, std::size_t hash) // key must not exist, and there must be a free slot
+        {
+            const std::size_t mask = m_tags.size() - 1;
+            std::size_t i = hash & mask;
+            while (m_tags[i] & 0x80)
+            {
+                i = (i + 1) & mask;
+            }
+            if (m_tags[i] == emptyTag)
+            {
+                ++m_used;
+            }
+            m_tags[i] = tagOf(hash);
+            m_slots[i] = std::move(item);
+        }
+    public:
+        BucketType() : m_used(0) {}
+        Value valueFor(const Key& key, std::size_t hash, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex); // lock on shared mode.
+            const std::size_t index = findIndex(key, hash);
+            return index == npos ? defaultValue : m_slots[index].second;
+        }
+        void addOrUpdateMapping(const Key& key, std::size_t hash, const Value& value, const Hash& hasher)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            const std::size_t index = findIndex(key, hash);
+            if (index != npos) // found, modify
+            {
+                m_slots[index].second = value;
+                return;
+            }
+            if ((m_used + 1) * 8 > m_tags.size() * 7) // not found, grow (or clean deleted slots) if too full, then insert
+            {
+                std::size_t size = 0;
+                for (auto tag : m_tags)
+                {
+                    size += (tag & 0x80) ? 1 : 0;
+                }
+                std::size_t newCapacity = 16;
+                while (newCapacity < (size + 1) * 2)
+                {
+                    newCapacity *= 2;
+                }
+                rehash(newCapacity, hasher);
+            }
+            insertNew(BucketValue(key, value), hash);
+        }
+        void removeMapping(const Key& key, std::size_t hash)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            const std::size_t index = findIndex(key, hash);
+            if (index != npos) // found
+            {
+                m_tags[index] = deletedTag; // keep probe sequences of other keys unbroken
+                m_slots[index] = BucketValue();
+            }
+        }
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    // std::hash of integers is identity, mix the bits so that both low bits (probe position) and high bits (tag) are random
+    static std::size_t mix(std::size_t hash)
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(hash) ^ (static_cast<std::uint64_t>(hash) >> 29)) * 0x9E3779B97F4A7C15ull);
+    }
+    BucketType& getBucket(std::size_t hash) const
+    {
+        const std::size_t bucketIndex = (hash >> 32) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        return getBucket(hash).valueFor(key, hash, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        getBucket(hash).addOrUpdateMapping(key, hash, value, m_hasher);
+    }
+    void removeMapping(const Key& key)
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        getBucket(hash).removeMapping(key, hash);
+    }
+    // get a snapshot of lookup table
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            const BucketType& bucket = *m_buckets[i];
+            for (std::size_t j = 0; j < bucket.m_tags.size(); ++j)
+            {
+                if (bucket.m_tags[j] & 0x80)
+                {
+                    res.insert(bucket.m_slots[j]);
+                }
+            }
+        }
+        return res;
+    }
+};
+
+// from P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ListLookupTable
+{
+private:
+    class BucketType
+    {
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    ListLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ListLookupTable(const ListLookupTable&) = delete;
+    ListLookupTable& operator=(const ListLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+};
+
+// fill the table with count entries, then look up random keys (half of them miss) on threadCount threads.
+template<typename Table>
+void benchmark(const char* name, std::size_t numBuckets, int count, int threadCount, int lookupsPerThread)
+{
+    const std::size_t heapBefore = heapBytes.load();
+    Table table(numBuckets);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    const std::size_t footprint = heapBytes.load() - heapBefore;
+    std::atomic<long long> hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                std::uint32_t x = 2463534242u + t; // xorshift
+                long long localHits = 0;
+                for (int i = 0; i < lookupsPerThread; ++i)
+                {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    const int key = static_cast<int>(x % (2u * count));
+                    localHits += table.valueFor(key, -1) == key ? 1 : 0;
+                }
+                hits += localHits;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(6) << name << " : " << count << " entries, " << std::setw(7) << numBuckets << " buckets, "
+        << threadCount << " threads : " << std::fixed << std::setprecision(2)
+        << static_cast<double>(lookupsPerThread) * threadCount / duration << " Mlookups/s, "
+        << static_cast<double>(footprint) / count << " bytes/entry, hit rate "
+        << static_cast<double>(hits) / (static_cast<double>(lookupsPerThread) * threadCount) << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+        table.addOrUpdateMapping(i, std::to_string(i) + "_copy");
+    }
+    auto lookupFunc = [&table](int count) {
+        for (int i = 0; i < 100; ++i)
+        {
+            [[maybe_unused]] std::string value = table.valueFor(count * 100 + i);
+            assert(value == std::to_string(count * 100 + i) + "_copy");
+        }
+    };
+    {
+        std::vector<std::jthread> vec;
+        for (int i = 0; i < 10; ++i)
+        {
+            vec.emplace_back(lookupFunc, i);
+        }
+    }
+    for (int i = 0; i < 1000; i += 2)
+    {
+        table.removeMapping(i);
+    }
+    [[maybe_unused]] auto snapshot = table.getMap();
+    assert(snapshot.size() == 500 && snapshot.begin()->first == 1 && table.valueFor(2, "none") == "none");
+
+    const int count = 1 << 20;
+    for (int threadCount : { 1, 4 })
+    {
+        // list version needs about one bucket (and one shared_mutex) per entry to keep chains short
+        benchmark<ListLookupTable<int, int>>("list", 1048573, count, threadCount, 2000000);
+        benchmark<ThreadSafeLookupTable<int, int>>("flat", 1031, count, threadCount, 2000000);
+    }
+    return 0;
+}
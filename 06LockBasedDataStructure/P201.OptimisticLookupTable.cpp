@@ -0,0 +1,515 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <stdexcept>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// from 07LockFreeDataStructure/P220.EpochBasedReclamation.cpp
+// epoch based reclamation (EBR):
+// readers only announce the global epoch once when entering a critical section (EpochGuard), not once per node.
+// a node retired in epoch e is deleted when global epoch reaches e + 2,
+// global epoch can only advance when every thread in critical section has announced the current epoch,
+// so all readers which might have seen the node have exited.
+// cost: a stalled reader blocks all reclamation, hazard pointers do not have this problem.
+class EpochDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t advanceInterval = 64; // try to advance epoch once per advanceInterval retires
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<bool> used { false };
+        std::atomic<std::uint64_t> state { 0 }; // (epoch << 1) | 1 when in critical section, 0 when quiescent
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+        std::uint64_t epoch;
+    };
+    class ThreadState
+    {
+        friend class EpochDomain;
+        EpochDomain& domain;
+        Record* record;
+        unsigned nesting;
+        std::vector<RetiredPointer> limbo; // ordered by epoch
+        std::size_t retiredSinceAdvance;
+    public:
+        ThreadState(EpochDomain& d) : domain(d), record(d.acquireRecord()), nesting(0), retiredSinceAdvance(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            record->state.store(0, std::memory_order_release);
+            record->used.store(false, std::memory_order_release);
+            domain.tryAdvance();
+            domain.reclaim(limbo);
+            domain.orphan(limbo);
+        }
+    };
+    std::atomic<std::uint64_t> globalEpoch;
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount;
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans;
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].used.load(std::memory_order_relaxed) && records[i].used.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No epoch records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    // advance global epoch if every thread in critical section has announced it.
+    void tryAdvance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::uint64_t s = records[i].state.load(std::memory_order_acquire);
+            if ((s & 1) && (s >> 1) != epoch)
+            {
+                return;
+            }
+        }
+        globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+    void reclaim(std::vector<RetiredPointer>& limbo)
+    {
+        const std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        auto safeEnd = std::find_if(limbo.begin(), limbo.end(), [epoch](const RetiredPointer& r) { return r.epoch + 2 > epoch; });
+        for (auto iter = limbo.begin(); iter != safeEnd; ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(safeEnd - limbo.begin(), std::memory_order_relaxed);
+        limbo.erase(limbo.begin(), safeEnd);
+    }
+    void orphan(std::vector<RetiredPointer>& limbo)
+    {
+        if (!limbo.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), limbo.begin(), limbo.end());
+            limbo.clear();
+        }
+    }
+    void adoptOrphans(std::vector<RetiredPointer>& limbo)
+    {
+        std::unique_lock lock(orphanMutex, std::try_to_lock);
+        if (lock.owns_lock() && !orphans.empty())
+        {
+            limbo.insert(limbo.end(), orphans.begin(), orphans.end());
+            orphans.clear();
+            std::stable_sort(limbo.begin(), limbo.end(), [](const RetiredPointer& a, const RetiredPointer& b) { return a.epoch < b.epoch; });
+        }
+    }
+    EpochDomain() : globalEpoch(1), recordCount(0), reclaimedCount(0) {}
+public:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+    ~EpochDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static EpochDomain& instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+    void enter()
+    {
+        ThreadState& state = threadState();
+        if (state.nesting++ == 0)
+        {
+            state.record->state.store((globalEpoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // announce before reading any shared pointer, once per critical section
+        }
+    }
+    void exit()
+    {
+        ThreadState& state = threadState();
+        if (--state.nesting == 0)
+        {
+            state.record->state.store(0, std::memory_order_release);
+        }
+    }
+    // p must have been unlinked from the data structure.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        // order the caller's unlink before reading the epoch, otherwise the load may return an older epoch
+        // while a reader which entered in the newer one still holds p, and p would be freed one epoch too early.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        state.limbo.push_back({ p, deleter, globalEpoch.load(std::memory_order_acquire) });
+        if (++state.retiredSinceAdvance >= advanceInterval)
+        {
+            state.retiredSinceAdvance = 0;
+            adoptOrphans(state.limbo);
+            tryAdvance();
+            reclaim(state.limbo);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+class EpochGuard
+{
+public:
+    EpochGuard()
+    {
+        EpochDomain::instance().enter();
+    }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+    ~EpochGuard()
+    {
+        EpochDomain::instance().exit();
+    }
+};
+
+// lookup table with a lock-free read path, based on P201.ThreadSafeLookupTable.cpp.
+// even an uncontended std::shared_lock writes the mutex (reader count), so readers of the same bucket
+// keep stealing one cache line from each other and read throughput does not grow with threads.
+// here every bucket is a singly linked list of immutable nodes:
+// - valueFor takes no lock, it only follows atomic pointers and copies a value out.
+//   the only store is the epoch announcement of EpochGuard, which goes to a cache line owned by current thread.
+// - writers of the same bucket are serialized by the bucket mutex. an update never modifies a published node,
+//   it links a new node in place of the old one, a remove unlinks the node, the old node is retired to EpochDomain.
+// - a reader standing on a retired node can still follow its next pointer, every node it can reach is alive
+//   until the reader leaves its critical section.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    struct Node
+    {
+        const Key key;
+        const Value value;
+        std::atomic<Node*> next;
+        Node(const Key& k, const Value& v, Node* n) : key(k), value(v), next(n) {}
+    };
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        std::atomic<Node*> m_head;
+        std::mutex m_mutex; // writers only
+        // link which points to node of key, or the null link at the end. only called by writers.
+        std::atomic<Node*>* findLinkFor(const Key& key)
+        {
+            std::atomic<Node*>* link = &m_head;
+            for (Node* p = link->load(std::memory_order_relaxed); p && !(p->key == key); p = link->load(std::memory_order_relaxed))
+            {
+                link = &p->next;
+            }
+            return link;
+        }
+    public:
+        BucketType() : m_head(nullptr) {}
+        ~BucketType()
+        {
+            for (Node* p = m_head.load(std::memory_order_relaxed); p;)
+            {
+                Node* next = p->next.load(std::memory_order_relaxed);
+                delete p;
+                p = next;
+            }
+        }
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            EpochGuard guard;
+            for (Node* p = m_head.load(std::memory_order_acquire); p; p = p->next.load(std::memory_order_acquire))
+            {
+                if (p->key == key)
+                {
+                    return p->value;
+                }
+            }
+            return defaultValue;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::atomic<Node*>* link = findLinkFor(key);
+            if (Node* old = link->load(std::memory_order_relaxed)) // found, replace
+            {
+                link->store(new Node(key, value, old->next.load(std::memory_order_relaxed)), std::memory_order_release);
+                EpochDomain::instance().retire(old);
+            }
+            else // not found, insert at head
+            {
+                m_head.store(new Node(key, value, m_head.load(std::memory_order_relaxed)), std::memory_order_release);
+            }
+        }
+        void removeMapping(const Key& key)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::atomic<Node*>* link = findLinkFor(key);
+            if (Node* old = link->load(std::memory_order_relaxed)) // found
+            {
+                link->store(old->next.load(std::memory_order_relaxed), std::memory_order_release); // old->next is kept for readers on old
+                EpochDomain::instance().retire(old);
+            }
+        }
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+    void removeMapping(const Key& key)
+    {
+        getBucket(key).removeMapping(key);
+    }
+    // get a snapshot of lookup table, all writers are blocked while copying.
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            for (Node* p = m_buckets[i]->m_head.load(std::memory_order_acquire); p; p = p->next.load(std::memory_order_acquire))
+            {
+                res.emplace(p->key, p->value);
+            }
+        }
+        return res;
+    }
+};
+
+// from P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class SharedMutexLookupTable
+{
+private:
+    class BucketType
+    {
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    SharedMutexLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    SharedMutexLookupTable(const SharedMutexLookupTable&) = delete;
+    SharedMutexLookupTable& operator=(const SharedMutexLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+};
+
+// read-mostly benchmark: a small hot table, readerCount threads look up random keys while one writer keeps updating.
+template<typename Table>
+double benchmark(int readerCount, int lookupsPerThread)
+{
+    const int count = 1024;
+    Table table(103);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    std::atomic<bool> done = false;
+    std::atomic<long long> sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::jthread writer([&]() {
+            for (int i = 0; !done.load(std::memory_order_relaxed); ++i)
+            {
+                table.addOrUpdateMapping(i % count, i % count);
+                std::this_thread::sleep_for(10us);
+            }
+        });
+        {
+            std::vector<std::jthread> readers;
+            for (int t = 0; t < readerCount; ++t)
+            {
+                readers.emplace_back([&, t]() {
+                    std::uint32_t x = 2463534242u + t; // xorshift
+                    long long localSum = 0;
+                    for (int i = 0; i < lookupsPerThread; ++i)
+                    {
+                        x ^= x << 13;
+                        x ^= x >> 17;
+                        x ^= x << 5;
+                        const int key = static_cast<int>(x % count);
+                        [[maybe_unused]] const int value = table.valueFor(key, -1);
+                        assert(value == key);
+                        localSum += value;
+                    }
+                    sink += localSum;
+                });
+            }
+        }
+        done = true;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(lookupsPerThread) * readerCount / duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+    }
+    {
+        std::vector<std::jthread> vec;
+        for (int t = 0; t < 8; ++t) // readers always see either the old or the new value, never a torn one
+        {
+            vec.emplace_back([&table]() {
+                for (int i = 0; i < 100000; ++i)
+                {
+                    const int key = i % 1000;
+                    [[maybe_unused]] std::string value = table.valueFor(key, "none");
+                    assert(value == "none" || value == std::to_string(key) || value == std::to_string(key) + "_copy");
+                }
+            });
+        }
+        vec.emplace_back([&table]() {
+            for (int i = 0; i < 1000; ++i)
+            {
+                table.addOrUpdateMapping(i, std::to_string(i) + "_copy");
+            }
+            for (int i = 0; i < 1000; i += 2)
+            {
+                table.removeMapping(i);
+            }
+        });
+    }
+    [[maybe_unused]] auto snapshot = table.getMap();
+    assert(snapshot.size() == 500 && snapshot.begin()->second == "1_copy" && table.valueFor(2, "none") == "none");
+
+    std::cout << std::setw(8) << "readers" << std::setw(22) << "shared_mutex(M/s)" << std::setw(22) << "lock-free read(M/s)" << std::endl;
+    for (int readerCount : { 1, 2, 4, 8 })
+    {
+        std::cout << std::setw(8) << readerCount << std::fixed << std::setprecision(2)
+            << std::setw(22) << benchmark<SharedMutexLookupTable<int, int>>(readerCount, 2000000)
+            << std::setw(22) << benchmark<ThreadSafeLookupTable<int, int>>(readerCount, 2000000) << std::endl;
+    }
+    std::cout << "reclaimed nodes : " << EpochDomain::instance().reclaimed() << std::endl;
+    return 0;
+}
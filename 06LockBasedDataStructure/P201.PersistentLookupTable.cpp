@@ -0,0 +1,601 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <type_traits>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std::chrono_literals;
+
+// how keys and values are stored in a snapshot image.
+// trivially copyable types are stored as their bytes, std::string as 4 bytes length followed by characters.
+// records are not aligned in the image, so they are always read with memcpy.
+// every read is checked against the end of its bucket, a corrupt image throws instead of reading past the mapping.
+inline void checkSnapshotBounds(const char* p, const char* end, std::size_t size)
+{
+    if (static_cast<std::size_t>(end - p) < size)
+    {
+        throw std::runtime_error("Corrupt snapshot record");
+    }
+}
+
+template<typename T>
+struct SnapshotCodec
+{
+    static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types and std::string can be saved");
+    static void write(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static T read(const char*& p, const char* end)
+    {
+        checkSnapshotBounds(p, end, sizeof(T));
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+    static bool readEquals(const char*& p, const char* end, const T& value) // compare without constructing a T when possible
+    {
+        return read(p, end) == value;
+    }
+    static void skip(const char*& p, const char* end)
+    {
+        checkSnapshotBounds(p, end, sizeof(T));
+        p += sizeof(T);
+    }
+};
+
+template<>
+struct SnapshotCodec<std::string>
+{
+    // length of the string, the characters are checked to be inside the bucket too
+    static std::uint32_t readLength(const char*& p, const char* end)
+    {
+        checkSnapshotBounds(p, end, sizeof(std::uint32_t));
+        std::uint32_t length;
+        std::memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        checkSnapshotBounds(p, end, length);
+        return length;
+    }
+    static void write(std::string& out, const std::string& value)
+    {
+        const std::uint32_t length = static_cast<std::uint32_t>(value.size());
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(value);
+    }
+    static std::string read(const char*& p, const char* end)
+    {
+        const std::uint32_t length = readLength(p, end);
+        std::string value(p, length);
+        p += length;
+        return value;
+    }
+    static bool readEquals(const char*& p, const char* end, const std::string& value)
+    {
+        const std::uint32_t length = readLength(p, end);
+        const bool equal = std::string_view(p, length) == value;
+        p += length;
+        return equal;
+    }
+    static void skip(const char*& p, const char* end)
+    {
+        p += readLength(p, end);
+    }
+};
+
+// a file mapped read-only into memory, unmapped on destruction
+class MappedFile
+{
+    int m_fd;
+    const char* m_data;
+    std::size_t m_size;
+public:
+    MappedFile(const std::string& path) : m_fd(::open(path.c_str(), O_RDONLY)), m_data(nullptr), m_size(0)
+    {
+        if (m_fd < 0)
+        {
+            throw std::runtime_error("Can not open " + path);
+        }
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("Can not map " + path);
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (p == MAP_FAILED)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("Can not map " + path);
+        }
+        m_data = static_cast<const char*>(p);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+        ::munmap(const_cast<char*>(m_data), m_size);
+        ::close(m_fd);
+    }
+    const char* data() const
+    {
+        return m_data;
+    }
+    std::size_t size() const
+    {
+        return m_size;
+    }
+};
+
+// lookup table which can be saved to a file and loaded back instantly, based on P201.ThreadSafeLookupTable.cpp.
+// image layout, position independent (offsets instead of pointers), so it can be used right where it is mapped:
+//   header : magic, bucket count, entry count
+//   offsets: bucketCount + 1 uint64, records of bucket i are bytes [offsets[i], offsets[i + 1]) of data
+//   data   : records (key, value) encoded by SnapshotCodec, bucket by bucket
+// loadSnapshot maps the file and only creates empty buckets pointing into the image, lookups are served from
+// the mapped records at once. a bucket is decoded into its own list (copy on first write) when it is first modified,
+// untouched buckets never cost a copy. Hash must give the same result in every process (no random seed).
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    using KeyCodec = SnapshotCodec<Key>;
+    using ValueCodec = SnapshotCodec<Value>;
+    static constexpr char magic[8] = { 'L', 'K', 'T', 'A', 'B', 'L', 'E', '1' };
+    struct Header
+    {
+        char magic[8];
+        std::uint64_t bucketCount;
+        std::uint64_t entryCount;
+    };
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        const char* m_imageBegin; // records in the image, used until the bucket is first written
+        const char* m_imageEnd;
+        bool m_inImage;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        // record of key in image, or nullptr. returned pointer points to the value.
+        const char* findInImage(const Key& key) const
+        {
+            for (const char* p = m_imageBegin; p != m_imageEnd; ValueCodec::skip(p, m_imageEnd))
+            {
+                if (KeyCodec::readEquals(p, m_imageEnd, key))
+                {
+                    return p;
+                }
+            }
+            return nullptr;
+        }
+        // copy on first write, caller holds the exclusive lock
+        void materialize()
+        {
+            if (m_inImage)
+            {
+                BucketData data; // the bucket is left in the image if a corrupt record throws
+                for (const char* p = m_imageBegin; p != m_imageEnd;)
+                {
+                    Key key = KeyCodec::read(p, m_imageEnd);
+                    data.emplace_back(std::move(key), ValueCodec::read(p, m_imageEnd));
+                }
+                m_data.swap(data);
+                m_inImage = false;
+            }
+        }
+        // append records of the bucket to out, caller holds the lock
+        void serialize(std::string& out) const
+        {
+            if (m_inImage)
+            {
+                out.append(m_imageBegin, m_imageEnd);
+                return;
+            }
+            for (const auto& item : m_data)
+            {
+                KeyCodec::write(out, item.first);
+                ValueCodec::write(out, item.second);
+            }
+        }
+        std::size_t size() const
+        {
+            if (!m_inImage)
+            {
+                return m_data.size();
+            }
+            std::size_t res = 0;
+            for (const char* p = m_imageBegin; p != m_imageEnd; ++res)
+            {
+                KeyCodec::skip(p, m_imageEnd);
+                ValueCodec::skip(p, m_imageEnd);
+            }
+            return res;
+        }
+    public:
+        BucketType() : m_imageBegin(nullptr), m_imageEnd(nullptr), m_inImage(false) {}
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex); // lock on shared mode.
+            if (m_inImage)
+            {
+                const char* p = findInImage(key);
+                return p ? ValueCodec::read(p, m_imageEnd) : defaultValue;
+            }
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            materialize();
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end()) // not found, insert
+            {
+                m_data.emplace_back(key, value);
+            }
+            else // found, modify
+            {
+                foundEntry->second = value;
+            }
+        }
+        void removeMapping(const Key& key)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            if (m_inImage && !findInImage(key)) // nothing to remove, keep using the image
+            {
+                return;
+            }
+            materialize();
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry != m_data.end()) // found
+            {
+                m_data.erase(foundEntry);
+            }
+        }
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    std::shared_ptr<const MappedFile> m_image; // kept alive as long as any bucket may point into it
+    static bool writeAll(int fd, const void* buffer, std::size_t size)
+    {
+        const char* p = static_cast<const char*>(buffer);
+        while (size > 0)
+        {
+            const ssize_t n = ::write(fd, p, size);
+            if (n < 0)
+            {
+                return false;
+            }
+            p += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+    void removeMapping(const Key& key)
+    {
+        getBucket(key).removeMapping(key);
+    }
+    // count of buckets which have been copied out of the image
+    std::size_t materializedBuckets() const
+    {
+        std::size_t res = 0;
+        for (const auto& bucket : m_buckets)
+        {
+            std::shared_lock<std::shared_mutex> lock(bucket->m_mutex);
+            res += bucket->m_inImage ? 0 : 1;
+        }
+        return res;
+    }
+    // write a consistent image of the table to path, all buckets are locked (shared) like getMap.
+    void saveSnapshot(const std::string& path) const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        Header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.bucketCount = m_buckets.size();
+        header.entryCount = 0;
+        std::vector<std::uint64_t> offsets;
+        offsets.reserve(m_buckets.size() + 1);
+        std::string data;
+        for (const auto& bucket : m_buckets)
+        {
+            offsets.push_back(data.size());
+            bucket->serialize(data);
+            header.entryCount += bucket->size();
+        }
+        offsets.push_back(data.size());
+        // write a new file and rename it over path: tables loaded from path keep mapping the old file.
+        // the file is synced before the rename and the directory after it, so even after a power loss
+        // path holds either the old or the new complete image, never a half written one.
+        const std::string tmpPath = path + ".tmp";
+        const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Can not open " + tmpPath);
+        }
+        const bool written = writeAll(fd, &header, sizeof(header))
+            && writeAll(fd, offsets.data(), offsets.size() * sizeof(std::uint64_t))
+            && writeAll(fd, data.data(), data.size())
+            && ::fsync(fd) == 0;
+        ::close(fd);
+        if (!written || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmpPath.c_str());
+            throw std::runtime_error("Can not write " + path);
+        }
+        const std::size_t slash = path.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        const int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        const bool synced = dirFd >= 0 && ::fsync(dirFd) == 0;
+        if (dirFd >= 0)
+        {
+            ::close(dirFd);
+        }
+        if (!synced)
+        {
+            throw std::runtime_error("Can not sync directory " + directory);
+        }
+    }
+    // map an image written by saveSnapshot, lookups are served from it immediately.
+    static std::unique_ptr<ThreadSafeLookupTable> loadSnapshot(const std::string& path, const Hash& hasher = Hash())
+    {
+        auto image = std::make_shared<const MappedFile>(path);
+        Header header;
+        if (image->size() < sizeof(Header))
+        {
+            throw std::runtime_error("Invalid snapshot " + path);
+        }
+        std::memcpy(&header, image->data(), sizeof(header));
+        const std::size_t maxOffsets = (image->size() - sizeof(Header)) / sizeof(std::uint64_t); // bucketCount + 1 can not overflow below
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.bucketCount == 0 || header.bucketCount >= maxOffsets)
+        {
+            throw std::runtime_error("Invalid snapshot " + path);
+        }
+        const std::size_t dataStart = sizeof(Header) + (header.bucketCount + 1) * sizeof(std::uint64_t);
+        auto table = std::make_unique<ThreadSafeLookupTable>(header.bucketCount, hasher);
+        const char* offsets = image->data() + sizeof(Header);
+        const char* data = image->data() + dataStart;
+        const std::size_t dataSize = image->size() - dataStart;
+        std::uint64_t begin = 0;
+        std::memcpy(&begin, offsets, sizeof(begin));
+        for (std::size_t i = 0; i < header.bucketCount; ++i)
+        {
+            std::uint64_t end;
+            std::memcpy(&end, offsets + (i + 1) * sizeof(std::uint64_t), sizeof(end));
+            if (end < begin || end > dataSize)
+            {
+                throw std::runtime_error("Invalid snapshot " + path);
+            }
+            BucketType& bucket = *table->m_buckets[i];
+            bucket.m_imageBegin = data + begin;
+            bucket.m_imageEnd = data + end;
+            bucket.m_inImage = true;
+            begin = end;
+        }
+        table->m_image = std::move(image);
+        return table;
+    }
+    // get a snapshot of lookup table
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (const auto& bucket : m_buckets)
+        {
+            if (bucket->m_inImage)
+            {
+                for (const char* p = bucket->m_imageBegin; p != bucket->m_imageEnd;)
+                {
+                    Key key = KeyCodec::read(p, bucket->m_imageEnd);
+                    res.emplace(std::move(key), ValueCodec::read(p, bucket->m_imageEnd));
+                }
+            }
+            else
+            {
+                res.insert(bucket->m_data.begin(), bucket->m_data.end());
+            }
+        }
+        return res;
+    }
+};
+
+// startup: rebuild the table entry by entry, compared with mapping a saved image.
+void benchmarkWarmStart(int count, const std::string& path)
+{
+    auto start = std::chrono::steady_clock::now();
+    ThreadSafeLookupTable<int, std::string> table(count / 2 * 2 + 1);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, "value_" + std::to_string(i));
+    }
+    auto rebuild = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    table.saveSnapshot(path);
+    auto save = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    auto loaded = ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+    auto load = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i += count / 1000)
+    {
+        [[maybe_unused]] std::string value = loaded->valueFor(i);
+        assert(value == "value_" + std::to_string(i));
+    }
+    auto firstLookups = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << count << " entries : rebuild " << rebuild << "ms, save " << save << "ms, load " << load
+        << "ms, first 1000 lookups " << firstLookups << "us" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    const std::string path = "P201.PersistentLookupTable.snapshot";
+    {
+        ThreadSafeLookupTable<int, std::string> table(103);
+        for (int i = 0; i < 1000; ++i)
+        {
+            table.addOrUpdateMapping(i, std::to_string(i) + "_copy");
+        }
+        table.saveSnapshot(path);
+    }
+    auto table = ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+    assert(table->materializedBuckets() == 0 && table->valueFor(1) == "1_copy" && table->valueFor(1000, "none") == "none");
+    table->addOrUpdateMapping(1, "updated"); // only the bucket of key 1 is copied
+    table->removeMapping(1000);
+    assert(table->materializedBuckets() == 1 && table->valueFor(1) == "updated" && table->valueFor(2) == "2_copy");
+    {
+        std::vector<std::jthread> vec;
+        for (int t = 0; t < 4; ++t)
+        {
+            vec.emplace_back([&table, t]() {
+                for (int i = t; i < 1000; i += 4)
+                {
+                    if (i % 3 == 0)
+                    {
+                        table->addOrUpdateMapping(i, std::to_string(i) + "_new");
+                    }
+                    else
+                    {
+                        [[maybe_unused]] std::string value = table->valueFor(i);
+                        assert(value == (i == 1 ? "updated" : std::to_string(i) + "_copy"));
+                    }
+                }
+            });
+        }
+    }
+    table->saveSnapshot(path); // saving again copies unmodified buckets from the image byte by byte
+    auto reloaded = ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+    assert(reloaded->getMap() == table->getMap() && reloaded->valueFor(3) == "3_new");
+
+    {
+        ThreadSafeLookupTable<int, std::string> source(7);
+        for (int i = 0; i < 70; ++i)
+        {
+            source.addOrUpdateMapping(i, std::to_string(i));
+        }
+        source.saveSnapshot(path);
+        auto mapped = ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+        mapped->addOrUpdateMapping(0, std::string(50, 'x')); // bucket 0 becomes longer, records of later buckets move
+        mapped->saveSnapshot(path); // over the file mapped is loaded from
+        for (int i = 1; i < 70; ++i) // unmaterialized buckets still read the old image
+        {
+            [[maybe_unused]] std::string value = mapped->valueFor(i);
+            assert(value == std::to_string(i));
+        }
+        assert(mapped->materializedBuckets() == 1);
+    }
+
+    {
+        // corrupt images are rejected: a string length running past its bucket, and a huge bucket count
+        ThreadSafeLookupTable<int, std::string> source(1);
+        source.addOrUpdateMapping(1, "abc");
+        source.saveSnapshot(path);
+        auto patch = [&path](long offset, std::uint64_t value, std::size_t size) {
+            std::FILE* file = std::fopen(path.c_str(), "r+b");
+            std::fseek(file, offset, SEEK_SET);
+            std::fwrite(&value, size, 1, file);
+            std::fclose(file);
+        };
+        const long recordsStart = 24 + 2 * 8; // header, 2 offsets
+        patch(recordsStart + sizeof(int), 0xffffff00, sizeof(std::uint32_t)); // length of "abc"
+        auto corrupt = ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+        [[maybe_unused]] bool thrown = false;
+        try
+        {
+            corrupt->valueFor(1);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        patch(8, std::uint64_t(-1), sizeof(std::uint64_t)); // bucket count
+        try
+        {
+            ThreadSafeLookupTable<int, std::string>::loadSnapshot(path);
+            thrown = false;
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        assert(thrown);
+    }
+
+    ThreadSafeLookupTable<int, double> numbers(7);
+    numbers.addOrUpdateMapping(1, 0.5);
+    numbers.saveSnapshot(path);
+    [[maybe_unused]] auto loadedNumbers = ThreadSafeLookupTable<int, double>::loadSnapshot(path);
+    assert(loadedNumbers->valueFor(1) == 0.5 && reloaded->valueFor(3) == "3_new");
+
+    benchmarkWarmStart(1 << 20, path);
+    std::remove(path.c_str());
+    return 0;
+}
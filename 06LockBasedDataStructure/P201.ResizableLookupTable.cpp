@@ -0,0 +1,430 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <limits>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// lookup table which grows automatically, based on P201.ThreadSafeLookupTable.cpp.
+// when count of entries exceeds maxLoadFactor * bucket count, a new bucket array of double size is installed,
+// the old array is kept until all its buckets are migrated. migration is incremental:
+// every writer helps to move a few old buckets before its own operation, so no call has to rehash the whole table.
+// entries of old bucket i go to new bucket i or i + oldSize (hash % 2n is hash % n or hash % n + n),
+// they are spliced from list to list without allocation.
+// an old bucket is used until it is marked migrated (under its own lock), after that its keys are in the new array.
+// the table level lock is only locked exclusively to install or drop a bucket array, which is O(1).
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        using BucketIterator = typename BucketData::iterator;
+        BucketData m_data;
+        bool m_migrated = false; // only for buckets of old array, protected by m_mutex
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        // following operations require m_mutex to be locked
+        const Value* find(const Key& key) const
+        {
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? nullptr : &foundEntry->second;
+        }
+        bool addOrUpdate(const Key& key, const Value& value) // return true if inserted
+        {
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end()) // not found, insert
+            {
+                m_data.emplace_back(key, value);
+                return true;
+            }
+            foundEntry->second = value; // found, modify
+            return false;
+        }
+        bool remove(const Key& key) // return true if removed
+        {
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                return false;
+            }
+            m_data.erase(foundEntry);
+            return true;
+        }
+    };
+    // buckets are allocated in chunks on first access, so installing a new array of n buckets only allocates
+    // n / chunkSize chunk pointers, constructing the buckets (and touching their memory) is spread over later operations.
+    class BucketArray
+    {
+        static constexpr std::size_t chunkSize = 1024;
+        std::size_t m_size;
+        std::unique_ptr<std::atomic<BucketType*>[]> m_chunks;
+        std::size_t chunkCount() const
+        {
+            return (m_size + chunkSize - 1) / chunkSize;
+        }
+    public:
+        BucketArray(std::size_t size) : m_size(size), m_chunks(new std::atomic<BucketType*>[chunkCount()]()) {}
+        BucketArray(const BucketArray&) = delete;
+        BucketArray& operator=(const BucketArray&) = delete;
+        ~BucketArray()
+        {
+            for (std::size_t i = 0; i < chunkCount(); ++i)
+            {
+                delete[] m_chunks[i].load();
+            }
+        }
+        std::size_t size() const
+        {
+            return m_size;
+        }
+        BucketType& operator[](std::size_t index) const
+        {
+            std::atomic<BucketType*>& chunk = m_chunks[index / chunkSize];
+            BucketType* p = chunk.load(std::memory_order_acquire);
+            if (!p)
+            {
+                BucketType* newChunk = new BucketType[chunkSize];
+                if (chunk.compare_exchange_strong(p, newChunk, std::memory_order_acq_rel))
+                {
+                    p = newChunk;
+                }
+                else // allocated by another thread
+                {
+                    delete[] newChunk;
+                }
+            }
+            return p[index % chunkSize];
+        }
+        // call f(bucket) for buckets which have been allocated
+        template<typename Function>
+        void forEachAllocated(Function f) const
+        {
+            for (std::size_t i = 0; i < chunkCount(); ++i)
+            {
+                if (BucketType* p = m_chunks[i].load(std::memory_order_acquire))
+                {
+                    for (std::size_t j = 0; j < chunkSize && i * chunkSize + j < m_size; ++j)
+                    {
+                        f(p[j]);
+                    }
+                }
+            }
+        }
+    };
+private:
+    mutable std::shared_mutex m_tableMutex; // exclusive only when installing or dropping a bucket array
+    std::unique_ptr<BucketArray> m_buckets;
+    std::unique_ptr<BucketArray> m_oldBuckets; // not null while migrating
+    std::atomic<std::size_t> m_nextToMigrate;  // next old bucket to be claimed by a helper
+    std::atomic<std::size_t> m_migratedCount;
+    std::atomic<std::size_t> m_size;
+    Hash m_hasher;
+    const double m_maxLoadFactor;
+    const std::size_t m_bucketsPerHelp;
+    // move old bucket index to new array, m_tableMutex must be locked in shared mode
+    void migrateBucket(std::size_t index)
+    {
+        BucketArray& oldBuckets = *m_oldBuckets;
+        BucketArray& newBuckets = *m_buckets;
+        BucketType& from = oldBuckets[index];
+        BucketType& low = newBuckets[index];
+        BucketType& high = newBuckets[index + oldBuckets.size()];
+        std::scoped_lock lock(from.m_mutex, low.m_mutex, high.m_mutex);
+        for (auto iter = from.m_data.begin(); iter != from.m_data.end();)
+        {
+            auto next = std::next(iter);
+            BucketType& to = (m_hasher(iter->first) % newBuckets.size() == index) ? low : high;
+            to.m_data.splice(to.m_data.end(), from.m_data, iter);
+            iter = next;
+        }
+        from.m_migrated = true;
+    }
+    // migrate at most m_bucketsPerHelp old buckets, return true if current thread has migrated the last one.
+    // m_tableMutex must be locked in shared mode
+    bool helpMigrate()
+    {
+        if (!m_oldBuckets)
+        {
+            return false;
+        }
+        const std::size_t oldSize = m_oldBuckets->size();
+        bool finished = false;
+        for (std::size_t i = 0; i < m_bucketsPerHelp; ++i)
+        {
+            const std::size_t index = m_nextToMigrate.fetch_add(1);
+            if (index >= oldSize)
+            {
+                break;
+            }
+            migrateBucket(index);
+            finished = (m_migratedCount.fetch_add(1) + 1 == oldSize);
+        }
+        return finished;
+    }
+    void finishMigration()
+    {
+        std::unique_lock tableLock(m_tableMutex);
+        m_oldBuckets.reset();
+    }
+    void startResize()
+    {
+        std::unique_lock tableLock(m_tableMutex);
+        if (m_oldBuckets || m_size.load() <= m_maxLoadFactor * m_buckets->size()) // another thread has done it
+        {
+            return;
+        }
+        m_oldBuckets = std::move(m_buckets);
+        m_buckets = std::make_unique<BucketArray>(m_oldBuckets->size() * 2);
+        m_nextToMigrate = 0;
+        m_migratedCount = 0;
+    }
+    // call f(bucket) with the bucket which key currently belongs to, bucket is locked by Lock (shared or exclusive).
+    // m_tableMutex must be locked in shared mode
+    template<typename Lock, typename Function>
+    auto withBucket(const Key& key, Function f) const
+    {
+        const std::size_t hash = m_hasher(key);
+        if (m_oldBuckets)
+        {
+            BucketType& oldBucket = (*m_oldBuckets)[hash % m_oldBuckets->size()];
+            Lock lock(oldBucket.m_mutex);
+            if (!oldBucket.m_migrated)
+            {
+                return f(oldBucket);
+            }
+        }
+        BucketType& bucket = (*m_buckets)[hash % m_buckets->size()];
+        Lock lock(bucket.m_mutex);
+        return f(bucket);
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    // bucketsPerHelp: count of old buckets a writer migrates, max value of std::size_t means migrating all at once (stop the world).
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash(), double maxLoadFactor = 2.0, std::size_t bucketsPerHelp = 2)
+        : m_buckets(std::make_unique<BucketArray>(numBuckets))
+        , m_nextToMigrate(0)
+        , m_migratedCount(0)
+        , m_size(0)
+        , m_hasher(hasher)
+        , m_maxLoadFactor(maxLoadFactor)
+        , m_bucketsPerHelp(bucketsPerHelp)
+    {
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        std::shared_lock tableLock(m_tableMutex);
+        return withBucket<std::shared_lock<std::shared_mutex>>(key, [&](const BucketType& bucket) -> Value {
+            const Value* value = bucket.find(key);
+            return value ? *value : defaultValue;
+        });
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        bool finished = false;
+        bool needResize = false;
+        {
+            std::shared_lock tableLock(m_tableMutex);
+            finished = helpMigrate();
+            const bool inserted = withBucket<std::unique_lock<std::shared_mutex>>(key, [&](BucketType& bucket) {
+                return bucket.addOrUpdate(key, value);
+            });
+            needResize = inserted && !m_oldBuckets && m_size.fetch_add(1) + 1 > m_maxLoadFactor * m_buckets->size();
+            if (inserted && m_oldBuckets)
+            {
+                m_size.fetch_add(1);
+            }
+        }
+        if (finished)
+        {
+            finishMigration();
+            finished = false; // must not finish the migration started below again
+        }
+        if (needResize)
+        {
+            startResize();
+            std::shared_lock tableLock(m_tableMutex);
+            finished = helpMigrate(); // the thread which starts a resize also helps
+        }
+        if (finished)
+        {
+            finishMigration();
+        }
+    }
+    void removeMapping(const Key& key)
+    {
+        bool finished = false;
+        {
+            std::shared_lock tableLock(m_tableMutex);
+            finished = helpMigrate();
+            if (withBucket<std::unique_lock<std::shared_mutex>>(key, [&](BucketType& bucket) { return bucket.remove(key); }))
+            {
+                m_size.fetch_sub(1);
+            }
+        }
+        if (finished)
+        {
+            finishMigration();
+        }
+    }
+    std::size_t size() const
+    {
+        return m_size.load();
+    }
+    std::size_t bucketCount() const
+    {
+        std::shared_lock tableLock(m_tableMutex);
+        return m_buckets->size();
+    }
+    // get a snapshot of lookup table, buckets are locked in order: old array, then new array, so no dead lock with migration.
+    std::map<Key, Value> getMap() const
+    {
+        std::shared_lock tableLock(m_tableMutex);
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        std::vector<const BucketType*> buckets;
+        for (const BucketArray* array : { m_oldBuckets.get(), m_buckets.get() })
+        {
+            if (!array)
+            {
+                continue;
+            }
+            array->forEachAllocated([&](const BucketType& bucket) {
+                locks.emplace_back(bucket.m_mutex);
+                buckets.push_back(&bucket);
+            });
+        }
+        std::map<Key, Value> res;
+        for (const BucketType* bucket : buckets)
+        {
+            res.insert(bucket->m_data.begin(), bucket->m_data.end());
+        }
+        return res;
+    }
+};
+
+// insert count entries from threadCount threads while readers look up, report the slowest single insert.
+void benchmark(const char* name, std::size_t bucketsPerHelp, int threadCount, int count)
+{
+    ThreadSafeLookupTable<int, int> table(19, std::hash<int>(), 2.0, bucketsPerHelp);
+    std::atomic<long long> maxLatency = 0;
+    std::atomic<bool> done = false;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::jthread reader([&]() {
+            for (int i = 0; !done; i = (i + 1) % count)
+            {
+                [[maybe_unused]] int value = table.valueFor(i, -1);
+                assert(value == -1 || value == i);
+            }
+        });
+        {
+            std::vector<std::jthread> writers;
+            for (int t = 0; t < threadCount; ++t)
+            {
+                writers.emplace_back([&, t]() {
+                    long long localMax = 0;
+                    for (int i = t; i < count; i += threadCount)
+                    {
+                        auto begin = std::chrono::steady_clock::now();
+                        table.addOrUpdateMapping(i, i);
+                        localMax = std::max<long long>(localMax, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+                    }
+                    long long current = maxLatency.load();
+                    while (current < localMax && !maxLatency.compare_exchange_weak(current, localMax))
+                    {
+                    }
+                });
+            }
+        }
+        done = true;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    assert(table.size() == static_cast<std::size_t>(count));
+    std::cout << std::setw(14) << name << " : " << threadCount << " writers, " << count << " entries, " << table.bucketCount() << " buckets, total "
+        << duration << "ms, slowest insert " << maxLatency.load() << "us" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table;
+    auto insertFunc = [&table](int begin) {
+        for (int i = begin; i < begin + 1000; ++i)
+        {
+            table.addOrUpdateMapping(i, std::to_string(i));
+        }
+    };
+    auto lookupFunc = [&table]() {
+        for (int i = 0; i < 4000; ++i)
+        {
+            [[maybe_unused]] std::string value = table.valueFor(i);
+            assert(value.empty() || value == std::to_string(i));
+        }
+    };
+    {
+        std::vector<std::jthread> vec;
+        for (int i = 0; i < 4; ++i)
+        {
+            vec.emplace_back(insertFunc, i * 1000);
+            vec.emplace_back(lookupFunc);
+        }
+    }
+    for (int i = 0; i < 4000; i += 2)
+    {
+        table.removeMapping(i);
+    }
+    [[maybe_unused]] auto snapshot = table.getMap();
+    assert(snapshot.size() == 2000 && table.size() == 2000);
+    std::cout << "2000 entries, " << table.bucketCount() << " buckets" << std::endl;
+
+    for (int round = 0; round < 100; ++round) // frequent resizes which finish and start a migration in one insert
+    {
+        ThreadSafeLookupTable<int, int> small(3, std::hash<int>(), 1.0, 1);
+        {
+            std::vector<std::jthread> vec;
+            for (int t = 0; t < 8; ++t)
+            {
+                vec.emplace_back([&small, t]() {
+                    for (int i = t * 500; i < t * 500 + 500; ++i)
+                    {
+                        small.addOrUpdateMapping(i, i);
+                    }
+                });
+            }
+        }
+        [[maybe_unused]] auto smallSnapshot = small.getMap();
+        assert(small.size() == 4000 && smallSnapshot.size() == 4000);
+    }
+
+    for (int threadCount : { 1, 4 })
+    {
+        benchmark("stop the world", std::numeric_limits<std::size_t>::max(), threadCount, 1 << 20);
+        benchmark("incremental", 2, threadCount, 1 << 20);
+    }
+    return 0;
+}
@@ -0,0 +1,465 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <memory>
+#include <limits>
+#include <cstdint>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// lookup table with consistent snapshots which do not block writers, based on P201.ThreadSafeLookupTable.cpp.
+// getMap of P201 locks all buckets until the whole table is copied, all writers stop for that long.
+// here buckets are versioned and copy-on-write:
+// - the table has a global version, only taking a snapshot increases it. a snapshot sees exactly the writes
+//   which read a version not greater than its own, writers read the version under their bucket lock.
+// - every bucket keeps a short list of (version, data) pairs, the last one is current. a write copies current data
+//   only if some snapshot might still need the old one (or an iterator still holds it), otherwise it modifies in place,
+//   so without snapshots a write costs the same as before.
+// - versions no active snapshot can see are dropped by the next write of the bucket.
+// a snapshot visits buckets one by one with a shared lock held only to pick the right version,
+// its iterator streams entries without materializing a std::map.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    using BucketValue = std::pair<Key, Value>;
+    using BucketData = std::vector<BucketValue>;
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        struct Version
+        {
+            std::uint64_t version;
+            std::shared_ptr<BucketData> data;
+        };
+        std::vector<Version> m_versions; // ordered by version, last one is current
+        mutable std::shared_mutex m_mutex;
+        const BucketData& current() const
+        {
+            return *m_versions.back().data;
+        }
+        // data seen by snapshot of given version
+        std::shared_ptr<const BucketData> dataAt(std::uint64_t version) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto iter = std::find_if(m_versions.rbegin(), m_versions.rend(), [version](const Version& v) { return v.version <= version; });
+            assert(iter != m_versions.rend());
+            return iter->data;
+        }
+    public:
+        BucketType() : m_versions { { 0, std::make_shared<BucketData>() } } {}
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    mutable std::atomic<std::uint64_t> m_version;
+    mutable std::mutex m_snapshotMutex;
+    mutable std::multiset<std::uint64_t> m_snapshots; // versions of active snapshots
+    mutable std::atomic<std::uint64_t> m_oldestSnapshot; // max value when there is no snapshot
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+    static auto findEntryFor(const BucketData& data, const Key& key)
+    {
+        return std::find_if(data.begin(), data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+    }
+    static auto findEntryFor(BucketData& data, const Key& key)
+    {
+        return std::find_if(data.begin(), data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+    }
+    // data of bucket which can be modified by current write, caller must hold the bucket lock exclusively.
+    BucketData& writableData(BucketType& bucket)
+    {
+        const std::uint64_t version = m_version.load(); // load version before oldest snapshot, see acquireSnapshot
+        const std::uint64_t oldest = m_oldestSnapshot.load();
+        auto& versions = bucket.m_versions;
+        // snapshots are always older than the global version, so oldest >= version means no active snapshot
+        // can see the current data, it can be relabeled and modified in place.
+        if ((versions.back().version == version || oldest >= version) && versions.back().data.use_count() == 1)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire); // the last iterator holding it has finished reading
+            versions.back().version = version;
+        }
+        else if (versions.back().version == version)
+        {
+            versions.back().data = std::make_shared<BucketData>(*versions.back().data);
+        }
+        else
+        {
+            versions.push_back({ version, std::make_shared<BucketData>(*versions.back().data) });
+        }
+        // version i is only seen by snapshots in [version i, version i + 1), drop it if all snapshots are newer
+        auto firstNeeded = versions.begin();
+        while (firstNeeded + 1 != versions.end() && (firstNeeded + 1)->version <= oldest)
+        {
+            ++firstNeeded;
+        }
+        versions.erase(versions.begin(), firstNeeded);
+        return *versions.back().data;
+    }
+    // a writer which reads version > snapshot version reads global version after the fetch_add,
+    // so it also sees oldest snapshot stored before, and keeps the versions this snapshot needs.
+    std::uint64_t acquireSnapshot() const
+    {
+        std::lock_guard<std::mutex> lock(m_snapshotMutex);
+        if (m_snapshots.empty())
+        {
+            m_oldestSnapshot.store(m_version.load());
+        }
+        const std::uint64_t version = m_version.fetch_add(1);
+        m_snapshots.insert(version);
+        return version;
+    }
+    void releaseSnapshot(std::uint64_t version) const
+    {
+        std::lock_guard<std::mutex> lock(m_snapshotMutex);
+        m_snapshots.erase(m_snapshots.find(version));
+        m_oldestSnapshot.store(m_snapshots.empty() ? std::numeric_limits<std::uint64_t>::max() : *m_snapshots.begin());
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    // a consistent point-in-time view of the table, writers proceed while it is alive.
+    class Snapshot
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+    private:
+        const ThreadSafeLookupTable& m_table;
+        const std::uint64_t m_version;
+        Snapshot(const ThreadSafeLookupTable& table) : m_table(table), m_version(table.acquireSnapshot()) {}
+    public:
+        // forward iterator over entries, holds data of one bucket at a time.
+        class Iterator
+        {
+        private:
+            const Snapshot* m_snapshot;
+            std::size_t m_bucketIndex;
+            std::shared_ptr<const BucketData> m_data;
+            std::size_t m_pos;
+            void skipEmptyBuckets()
+            {
+                const std::size_t bucketCount = m_snapshot->m_table.m_buckets.size();
+                while (m_bucketIndex < bucketCount && m_pos == m_data->size())
+                {
+                    ++m_bucketIndex;
+                    m_pos = 0;
+                    m_data = m_bucketIndex < bucketCount ? m_snapshot->m_table.m_buckets[m_bucketIndex]->dataAt(m_snapshot->m_version) : nullptr;
+                }
+            }
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = BucketValue;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+            Iterator() : m_snapshot(nullptr), m_bucketIndex(0), m_pos(0) {}
+            Iterator(const Snapshot* snapshot, std::size_t bucketIndex)
+                : m_snapshot(snapshot)
+                , m_bucketIndex(bucketIndex)
+                , m_pos(0)
+            {
+                if (m_bucketIndex < m_snapshot->m_table.m_buckets.size())
+                {
+                    m_data = m_snapshot->m_table.m_buckets[m_bucketIndex]->dataAt(m_snapshot->m_version);
+                    skipEmptyBuckets();
+                }
+            }
+            reference operator*() const
+            {
+                return (*m_data)[m_pos];
+            }
+            pointer operator->() const
+            {
+                return &(*m_data)[m_pos];
+            }
+            Iterator& operator++()
+            {
+                ++m_pos;
+                skipEmptyBuckets();
+                return *this;
+            }
+            Iterator operator++(int)
+            {
+                Iterator res = *this;
+                ++*this;
+                return res;
+            }
+            friend bool operator==(const Iterator& lhs, const Iterator& rhs)
+            {
+                return lhs.m_bucketIndex == rhs.m_bucketIndex && lhs.m_pos == rhs.m_pos;
+            }
+        };
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot()
+        {
+            m_table.releaseSnapshot(m_version);
+        }
+        Iterator begin() const
+        {
+            return Iterator(this, 0);
+        }
+        Iterator end() const
+        {
+            return Iterator(this, m_table.m_buckets.size());
+        }
+        Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+        {
+            auto data = m_table.getBucket(key).dataAt(m_version);
+            auto foundEntry = findEntryFor(*data, key);
+            return (foundEntry == data->end()) ? defaultValue : foundEntry->second;
+        }
+    };
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+        , m_version(1)
+        , m_oldestSnapshot(std::numeric_limits<std::uint64_t>::max())
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        const BucketType& bucket = getBucket(key);
+        std::shared_lock<std::shared_mutex> lock(bucket.m_mutex);
+        auto foundEntry = findEntryFor(bucket.current(), key);
+        return (foundEntry == bucket.current().end()) ? defaultValue : foundEntry->second;
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        BucketType& bucket = getBucket(key);
+        std::lock_guard<std::shared_mutex> lock(bucket.m_mutex);
+        BucketData& data = writableData(bucket);
+        auto foundEntry = findEntryFor(data, key);
+        if (foundEntry == data.end()) // not found, insert
+        {
+            data.emplace_back(key, value);
+        }
+        else // found, modify
+        {
+            foundEntry->second = value;
+        }
+    }
+    void removeMapping(const Key& key)
+    {
+        BucketType& bucket = getBucket(key);
+        std::lock_guard<std::shared_mutex> lock(bucket.m_mutex);
+        if (findEntryFor(bucket.current(), key) == bucket.current().end()) // not found, do not copy the bucket
+        {
+            return;
+        }
+        BucketData& data = writableData(bucket);
+        auto foundEntry = findEntryFor(data, key);
+        *foundEntry = std::move(data.back());
+        data.pop_back();
+    }
+    // the snapshot must not outlive the table.
+    Snapshot snapshot() const
+    {
+        return Snapshot(*this);
+    }
+    // get a snapshot of lookup table as std::map, writers are not blocked.
+    std::map<Key, Value> getMap() const
+    {
+        Snapshot s = snapshot();
+        return std::map<Key, Value>(s.begin(), s.end());
+    }
+};
+
+// from P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LockAllLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class LockAllLookupTable<Key, Value, Hash>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    LockAllLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    LockAllLookupTable(const LockAllLookupTable&) = delete;
+    LockAllLookupTable& operator=(const LockAllLookupTable&) = delete;
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            res.insert(m_buckets[i]->m_data.begin(), m_buckets[i]->m_data.end());
+        }
+        return res;
+    }
+};
+
+// writers keep updating random keys while another thread copies the table with getMap several times,
+// report the longest time a single write takes.
+template<typename Table>
+void benchmark(const char* name, int count, int writerCount, int snapshotCount)
+{
+    Table table(count / 2 * 2 + 1);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    std::atomic<bool> done = false;
+    std::atomic<long long> writes = 0;
+    std::atomic<long long> maxWriteNs = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> writers;
+        for (int t = 0; t < writerCount; ++t)
+        {
+            writers.emplace_back([&, t]() {
+                std::uint32_t x = 2463534242u + t; // xorshift
+                long long localWrites = 0;
+                long long localMax = 0;
+                while (!done.load(std::memory_order_relaxed))
+                {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    auto writeStart = std::chrono::steady_clock::now();
+                    table.addOrUpdateMapping(static_cast<int>(x % count), static_cast<int>(x));
+                    localMax = std::max<long long>(localMax, (std::chrono::steady_clock::now() - writeStart).count());
+                    ++localWrites;
+                }
+                writes += localWrites;
+                long long m = maxWriteNs.load();
+                while (m < localMax && !maxWriteNs.compare_exchange_weak(m, localMax))
+                {
+                }
+            });
+        }
+        for (int i = 0; i < snapshotCount; ++i)
+        {
+            [[maybe_unused]] auto snapshot = table.getMap();
+            assert(snapshot.size() == static_cast<std::size_t>(count));
+        }
+        done = true;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(9) << name << " : " << snapshotCount << " snapshots of " << count << " entries in " << duration / 1000
+        << "ms, " << std::fixed << std::setprecision(2) << static_cast<double>(writes) / duration << " Mwrites/s, slowest write "
+        << maxWriteNs / 1000 << "us" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+    }
+    {
+        auto snapshot = table.snapshot();
+        for (int i = 0; i < 1000; i += 2)
+        {
+            table.removeMapping(i);
+            table.addOrUpdateMapping(i + 1, "updated");
+        }
+        assert(std::distance(snapshot.begin(), snapshot.end()) == 1000 && snapshot.valueFor(1) == "1" && snapshot.valueFor(2) == "2");
+        assert(table.valueFor(1) == "updated" && table.valueFor(2, "none") == "none");
+    }
+    assert(table.getMap().size() == 500);
+
+    // a single writer sets keys 0, 1, ..., count - 1 to round r, then to round r + 1, and so on.
+    // a consistent snapshot always sees a prefix of keys in round r and the rest in round r - 1.
+    {
+        const int count = 1000;
+        ThreadSafeLookupTable<int, int> rounds(103);
+        for (int i = 0; i < count; ++i)
+        {
+            rounds.addOrUpdateMapping(i, 0);
+        }
+        std::atomic<bool> done = false;
+        std::jthread writer([&]() {
+            for (int r = 1; !done.load(std::memory_order_relaxed); ++r)
+            {
+                for (int i = 0; i < count; ++i)
+                {
+                    rounds.addOrUpdateMapping(i, r);
+                }
+            }
+        });
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto snapshot = rounds.getMap();
+            [[maybe_unused]] const int first = snapshot.begin()->second;
+            [[maybe_unused]] bool consistent = std::is_sorted(snapshot.begin(), snapshot.end(),
+                [](const auto& a, const auto& b) { return a.second > b.second; }) && first - snapshot.rbegin()->second <= 1;
+            assert(consistent);
+        }
+        done = true;
+    }
+
+    benchmark<LockAllLookupTable<int, int>>("lock all", 1 << 20, 4, 5);
+    benchmark<ThreadSafeLookupTable<int, int>>("versioned", 1 << 20, 4, 5);
+    return 0;
+}
@@ -0,0 +1,719 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <forward_list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <type_traits>
+#include <stdexcept>
+#include <ranges>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+using namespace std::chrono_literals;
+
+// count bytes on heap, for memory footprint comparison
+std::atomic<std::size_t> heapBytes = 0;
+void* allocate(std::size_t size, std::size_t alignment)
+{
+    // keep size in front of the block, so unsized delete can account it too
+    alignment = std::max(alignment, alignof(std::max_align_t));
+    void* p = std::aligned_alloc(alignment, (size + 2 * alignment - 1) / alignment * alignment);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(p) = size;
+    heapBytes.fetch_add(size, std::memory_order_relaxed);
+    return static_cast<char*>(p) + alignment;
+}
+void deallocate(void* p, std::size_t alignment) noexcept
+{
+    if (p)
+    {
+        void* block = static_cast<char*>(p) - std::max(alignment, alignof(std::max_align_t));
+        heapBytes.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+void* operator new(std::size_t size)
+{
+    return allocate(size, alignof(std::max_align_t));
+}
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p) noexcept
+{
+    deallocate(p, alignof(std::max_align_t));
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+    deallocate(p, alignof(std::max_align_t));
+}
+void operator delete(void* p, std::align_val_t alignment) noexcept
+{
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    deallocate(p, static_cast<std::size_t>(alignment));
+}
+
+// from 09AdvancedThreadManagement/P311.WaitForThreadPool.cpp, the thread pool and its queue
+template<typename T>
+class ThreadSafeQueue
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        struct std::unique_ptr<node> next;
+    };
+    std::mutex headMutex;
+    std::unique_ptr<node> head;
+    std::mutex tailMutex;
+    node* tail;
+    std::condition_variable dataCond;
+    node* getTail()
+    {
+        std::lock_guard tailLock(tailMutex);
+        return tail;
+    }
+    std::unique_ptr<node> popHead()
+    {
+        std::unique_ptr<node> oldHead = std::move(head);
+        head = std::move(oldHead->next);
+        return oldHead;
+    }
+    std::unique_lock<std::mutex> waitForData()
+    {
+        std::unique_lock<std::mutex> headLock(headMutex);
+        dataCond.wait(headLock, [&]() -> bool { return head.get() != getTail(); });
+        return headLock;
+    }
+    std::unique_ptr<node> waitPopHead()
+    {
+        std::unique_lock<std::mutex> headLock(waitForData());
+        return popHead();
+    }
+    std::unique_ptr<node> waitPopHead(T& value)
+    {
+        std::unique_lock<std::mutex> headLock(waitForData());
+        value = std::move(*head->data); // if throw exception here, no data will be removed.
+        return popHead();
+    }
+    std::unique_ptr<node> tryPopHead()
+    {
+        std::lock_guard headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            return std::unique_ptr<node>();
+        }
+        return popHead();
+    }
+    std::unique_ptr<node> tryPopHead(T& value)
+    {
+        std::lock_guard headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            return std::unique_ptr<node>();
+        }
+        value = std::move(*head->data); // if throw exception here, no data will be removed.
+        return popHead();
+    }
+public:
+    ThreadSafeQueue() : head(std::make_unique<node>()), tail(head.get()) {}
+    ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue& other) = delete;
+    std::shared_ptr<T> tryPop()
+    {
+        std::unique_ptr<node> oldHead = tryPopHead();
+        return oldHead ? std::move(oldHead->data) : std::shared_ptr<T>();
+    }
+    bool tryPop(T& value)
+    {
+        std::unique_ptr<node> oldHead = tryPopHead(value);
+        return bool(oldHead);
+    }
+    std::shared_ptr<T> waitAndPop()
+    {
+        std::unique_ptr<node> oldHead = waitPopHead();
+        return oldHead->data;
+    }
+    void waitAndPop(T& value)
+    {
+        std::unique_ptr<node> oldHead = waitPopHead(value);
+    }
+    void push(T value)
+    {
+        std::shared_ptr<T> newData = std::make_shared<T>(std::move(value));
+        std::unique_ptr<node> p = std::make_unique<node>();
+        node* newTail = p.get();
+        {
+            std::lock_guard tailLock(tailMutex); // minimize the critical section
+            tail->data = std::move(newData);
+            tail->next = std::move(p);
+            tail = newTail;
+        }
+        dataCond.notify_one();
+    }
+    bool empty() const
+    {
+        std::lock_guard headLock(headMutex);
+        return head.get() == getTail();
+    }
+};
+
+// to replace std::function as task type of thread pool, move-only type
+class FunctionWrapper
+{
+    struct ImplBase
+    {
+        virtual void call() = 0;
+        virtual ~ImplBase() {}
+    };
+    std::unique_ptr<ImplBase> impl;
+    template<typename F>
+    struct ImplType : public ImplBase
+    {
+        F f;
+        ImplType(F&& _f) : f(std::move(_f)) {}
+        void call() { f(); }
+    };
+public:
+    FunctionWrapper() = default;
+    template<typename F>
+    FunctionWrapper(F&& f) : impl(new ImplType<F>(std::move(f))) {}
+    
+    FunctionWrapper(const FunctionWrapper&) = delete;
+    FunctionWrapper(FunctionWrapper&& other) : impl(std::move(other.impl)) {}
+    
+    FunctionWrapper& operator=(FunctionWrapper&& other)
+    {
+        impl = std::move(other.impl);
+        return *this;
+    }
+    FunctionWrapper& operator=(const FunctionWrapper&) = delete;
+
+    void operator()()
+    {
+        if (impl)
+        {
+            impl->call();
+        }
+    }
+};
+
+class ThreadPool
+{
+    std::atomic<bool> done;
+    ThreadSafeQueue<FunctionWrapper> workQueue;
+    std::vector<std::jthread> threads;
+    void workerThread()
+    {
+        while (!done)
+        {
+            if (auto spTask = workQueue.tryPop())
+            {
+                (*spTask)();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+public:
+    ThreadPool() : done(false)
+    {
+        const std::size_t threadCount = std::thread::hardware_concurrency();
+        try
+        {
+            for (std::size_t i = 0; i < threadCount; ++i)
+            {
+                threads.push_back(std::jthread(&ThreadPool::workerThread, this));
+            }
+        }
+        catch(...)
+        {
+            done = true;
+            throw;
+        }
+    }
+    ~ThreadPool()
+    {
+        done = true;
+    }
+    template<typename FunctionType>
+    std::future<typename std::invoke_result_t<FunctionType>> submit(FunctionType f)
+    {
+        using ResultType = typename std::invoke_result_t<FunctionType>;
+        std::packaged_task<ResultType()> task(std::move(f));
+        std::future<ResultType> res(task.get_future());
+        workQueue.push(std::move(task));
+        return res;
+    }
+};
+
+// lookup table with lock striping, based on P201.ThreadSafeLookupTable.cpp.
+// every bucket of P201 carries its own std::shared_mutex (56 bytes on glibc), so memory of locks grows with bucket count,
+// and neighboring locks share cache lines, threads locking different buckets still contend on the same line.
+// here locks are a separate array of stripes, bucket i is protected by stripe i % stripe count:
+// - stripe count is independent of bucket count, 2 * cores by default, enough for all threads to rarely collide.
+// - every stripe is padded to a cache line, so stripes never falsely share.
+// - a bucket is only a std::forward_list (one pointer), a table can have millions of buckets without millions of mutexes.
+// getMap only needs to lock all stripes, in index order.
+// bulk operations run on a ThreadPool (P311), work is handed to tasks by stripe or by bucket range:
+// - bulkInsert partitions the input by stripe group in parallel, then every task fills the buckets of its own stripes,
+//   no two tasks ever wait for the same lock.
+// - parallelForEach and parallelReduce give every task a contiguous range of buckets.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    using BucketValue = std::pair<Key, Value>;
+    using BucketType = std::forward_list<BucketValue>;
+    struct alignas(64) Stripe
+    {
+        mutable std::shared_mutex mutex;
+    };
+    std::vector<BucketType> m_buckets;
+    std::vector<Stripe> m_stripes;
+    Hash m_hasher;
+    std::size_t bucketIndex(const Key& key) const
+    {
+        return m_hasher(key) % m_buckets.size();
+    }
+    std::shared_mutex& stripeOf(std::size_t bucketIndex) const
+    {
+        return m_stripes[bucketIndex % m_stripes.size()].mutex;
+    }
+    static auto findEntryFor(const BucketType& bucket, const Key& key)
+    {
+        return std::find_if(bucket.begin(), bucket.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+    }
+    static auto findEntryFor(BucketType& bucket, const Key& key)
+    {
+        return std::find_if(bucket.begin(), bucket.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+    }
+    template<typename K, typename V>
+    static void insertOrAssign(BucketType& bucket, K&& key, V&& value)
+    {
+        auto foundEntry = findEntryFor(bucket, key);
+        if (foundEntry == bucket.end()) // not found, insert
+        {
+            bucket.emplace_front(std::forward<K>(key), std::forward<V>(value));
+        }
+        else // found, modify
+        {
+            foundEntry->second = std::forward<V>(value);
+        }
+    }
+    static std::size_t defaultTaskCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency()) * 4; // a few tasks per thread to balance load
+    }
+    // run func(first, last) for task ranges of [0, count) on pool, return results in order
+    template<typename Func>
+    static auto runRanges(ThreadPool& pool, std::size_t count, std::size_t taskCount, Func func)
+    {
+        using ResultType = std::invoke_result_t<Func&, std::size_t, std::size_t>;
+        std::vector<std::future<ResultType>> futures;
+        const std::size_t tasks = std::max<std::size_t>(1, std::min(taskCount, count));
+        for (std::size_t i = 0; i < tasks; ++i)
+        {
+            futures.push_back(pool.submit([&func, first = count * i / tasks, last = count * (i + 1) / tasks]() {
+                return func(first, last);
+            }));
+        }
+        for (auto& f : futures) // tasks reference func and caller's locals, let all of them finish before rethrowing
+        {
+            f.wait();
+        }
+        if constexpr (std::is_void_v<ResultType>)
+        {
+            for (auto& f : futures)
+            {
+                f.get();
+            }
+        }
+        else
+        {
+            std::vector<ResultType> results;
+            for (auto& f : futures)
+            {
+                results.push_back(f.get());
+            }
+            return results;
+        }
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    static std::size_t defaultStripeCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency()) * 2;
+    }
+    // numBuckets better be prime number
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, std::size_t numStripes = defaultStripeCount(), const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_stripes(std::min(numStripes, numBuckets))
+        , m_hasher(hasher)
+    {
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    std::size_t stripeCount() const
+    {
+        return m_stripes.size();
+    }
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        const std::size_t index = bucketIndex(key);
+        std::shared_lock<std::shared_mutex> lock(stripeOf(index)); // lock on shared mode.
+        auto foundEntry = findEntryFor(m_buckets[index], key);
+        return (foundEntry == m_buckets[index].end()) ? defaultValue : foundEntry->second;
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        const std::size_t index = bucketIndex(key);
+        std::lock_guard<std::shared_mutex> lock(stripeOf(index));
+        insertOrAssign(m_buckets[index], key, value);
+    }
+    void removeMapping(const Key& key)
+    {
+        const std::size_t index = bucketIndex(key);
+        std::lock_guard<std::shared_mutex> lock(stripeOf(index));
+        m_buckets[index].remove_if([&](const BucketValue& item) { return item.first == key; });
+    }
+    // insert or update all (key, value) pairs of entries, a later pair wins over an earlier one with the same key.
+    // 1. input is cut into chunks, every task sorts the entries of its chunk by stripe group (stripe % groups).
+    // 2. every task owns one stripe group, locks its stripes and inserts the entries of its group from all chunks in order.
+    // other operations may run concurrently, they only wait for the stripe they need.
+    template<std::ranges::random_access_range Range>
+    void bulkInsert(const Range& entries, ThreadPool& pool)
+    {
+        using Entry = std::ranges::range_value_t<Range>;
+        const std::size_t count = std::ranges::size(entries);
+        const std::size_t groupCount = std::min(defaultTaskCount(), m_stripes.size());
+        struct Item
+        {
+            std::size_t bucketIndex;
+            const Entry* entry;
+        };
+        auto chunks = runRanges(pool, count, defaultTaskCount(), [&](std::size_t first, std::size_t last) {
+            std::vector<std::vector<Item>> groups(groupCount);
+            for (std::size_t i = first; i < last; ++i)
+            {
+                const Entry& entry = std::ranges::begin(entries)[i];
+                const std::size_t index = bucketIndex(entry.first);
+                groups[index % m_stripes.size() % groupCount].push_back({ index, &entry });
+            }
+            return groups;
+        });
+        runRanges(pool, groupCount, groupCount, [&](std::size_t firstGroup, std::size_t lastGroup) {
+            for (std::size_t group = firstGroup; group < lastGroup; ++group)
+            {
+                std::vector<std::unique_lock<std::shared_mutex>> locks;
+                for (std::size_t stripe = group; stripe < m_stripes.size(); stripe += groupCount)
+                {
+                    locks.emplace_back(m_stripes[stripe].mutex);
+                }
+                for (const auto& chunk : chunks)
+                {
+                    for (const Item& item : chunk[group])
+                    {
+                        insertOrAssign(m_buckets[item.bucketIndex], item.entry->first, item.entry->second);
+                    }
+                }
+            }
+        });
+    }
+    // run func(key, value) for every entry, on pool. func is called concurrently and must be thread safe,
+    // it must not access the table. the view is not a snapshot, entries can change between buckets.
+    template<typename Func>
+    void parallelForEach(Func func, ThreadPool& pool) const
+    {
+        runRanges(pool, m_buckets.size(), defaultTaskCount(), [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = first; i < last; ++i)
+            {
+                std::shared_lock<std::shared_mutex> lock(stripeOf(i));
+                for (const auto& item : m_buckets[i])
+                {
+                    func(item.first, item.second);
+                }
+            }
+        });
+    }
+    // fold all entries: reduce(init, map(key, value) of every entry), in unspecified order and grouping,
+    // so reduce should be associative and commutative. same consistency as parallelForEach.
+    template<typename T, typename MapFunc, typename ReduceFunc>
+    T parallelReduce(T init, MapFunc map, ReduceFunc reduce, ThreadPool& pool) const
+    {
+        auto partials = runRanges(pool, m_buckets.size(), defaultTaskCount(), [&](std::size_t first, std::size_t last) {
+            std::optional<T> acc;
+            for (std::size_t i = first; i < last; ++i)
+            {
+                std::shared_lock<std::shared_mutex> lock(stripeOf(i));
+                for (const auto& item : m_buckets[i])
+                {
+                    acc = acc ? reduce(std::move(*acc), map(item.first, item.second)) : T(map(item.first, item.second));
+                }
+            }
+            return acc;
+        });
+        for (auto& partial : partials)
+        {
+            if (partial)
+            {
+                init = reduce(std::move(init), std::move(*partial));
+            }
+        }
+        return init;
+    }
+    // get a snapshot of lookup table
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_stripes.size());
+        for (const auto& stripe : m_stripes)
+        {
+            locks.emplace_back(stripe.mutex);
+        }
+        std::map<Key, Value> res;
+        for (const auto& bucket : m_buckets)
+        {
+            res.insert(bucket.begin(), bucket.end());
+        }
+        return res;
+    }
+};
+
+// from P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class PerBucketLockLookupTable
+{
+private:
+    class BucketType
+    {
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    PerBucketLockLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    PerBucketLockLookupTable(const PerBucketLockLookupTable&) = delete;
+    PerBucketLockLookupTable& operator=(const PerBucketLockLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+};
+
+// fill the table with count entries, then look up random keys (half of them miss) on threadCount threads.
+template<typename Table>
+void benchmark(const char* name, std::size_t numBuckets, int count, int threadCount, int lookupsPerThread)
+{
+    const std::size_t heapBefore = heapBytes.load();
+    Table table(numBuckets);
+    const std::size_t emptyFootprint = heapBytes.load() - heapBefore;
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    const std::size_t footprint = heapBytes.load() - heapBefore;
+    std::atomic<long long> hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                std::uint32_t x = 2463534242u + t; // xorshift
+                long long localHits = 0;
+                for (int i = 0; i < lookupsPerThread; ++i)
+                {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    const int key = static_cast<int>(x % (2u * count));
+                    localHits += table.valueFor(key, -1) == key ? 1 : 0;
+                }
+                hits += localHits;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(10) << name << " : " << numBuckets << " buckets, " << threadCount << " threads : "
+        << std::fixed << std::setprecision(2) << static_cast<double>(lookupsPerThread) * threadCount / duration << " Mlookups/s, "
+        << static_cast<double>(emptyFootprint) / numBuckets << " bytes/bucket, " << static_cast<double>(footprint) / count
+        << " bytes/entry" << std::endl;
+}
+
+// load count entries one by one with addOrUpdateMapping, and with bulkInsert on a thread pool.
+void benchmarkBulkLoad(int count, ThreadPool& pool)
+{
+    std::vector<std::pair<int, int>> entries(count);
+    for (int i = 0; i < count; ++i)
+    {
+        entries[i] = { i, i };
+    }
+    auto measure = [&](auto load) {
+        ThreadSafeLookupTable<int, int> table(count / 2 * 2 + 1);
+        auto start = std::chrono::steady_clock::now();
+        load(table);
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        [[maybe_unused]] long long sum = table.parallelReduce(0LL, [](int, int value) { return static_cast<long long>(value); }, std::plus<>(), pool);
+        assert(sum == static_cast<long long>(count) * (count - 1) / 2);
+        return duration;
+    };
+    auto single = measure([&](auto& table) {
+        for (const auto& [key, value] : entries)
+        {
+            table.addOrUpdateMapping(key, value);
+        }
+    });
+    auto bulk = measure([&](auto& table) { table.bulkInsert(entries, pool); });
+    std::cout << "load " << count << " entries with " << std::thread::hardware_concurrency() << " threads : one by one "
+        << single << "ms, bulkInsert " << bulk << "ms" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103, 4);
+    assert(table.stripeCount() == 4);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+        table.addOrUpdateMapping(i, std::to_string(i) + "_copy");
+    }
+    auto lookupFunc = [&table](int count) {
+        for (int i = 0; i < 100; ++i)
+        {
+            [[maybe_unused]] std::string value = table.valueFor(count * 100 + i);
+            assert(value == std::to_string(count * 100 + i) + "_copy");
+        }
+    };
+    {
+        std::vector<std::jthread> vec;
+        for (int i = 0; i < 10; ++i)
+        {
+            vec.emplace_back(lookupFunc, i);
+        }
+    }
+    for (int i = 0; i < 1000; i += 2)
+    {
+        table.removeMapping(i);
+    }
+    [[maybe_unused]] auto snapshot = table.getMap();
+    assert(snapshot.size() == 500 && snapshot.begin()->first == 1 && table.valueFor(2, "none") == "none");
+
+    {
+        ThreadPool pool;
+        std::vector<std::pair<int, std::string>> entries;
+        for (int i = 0; i < 1000; ++i)
+        {
+            entries.emplace_back(i, std::to_string(i));
+        }
+        entries.emplace_back(1, "last one wins");
+        table.bulkInsert(entries, pool);
+        assert(table.valueFor(1) == "last one wins" && table.valueFor(2) == "2");
+        std::atomic<std::size_t> visited = 0;
+        table.parallelForEach([&visited](int, const std::string&) { ++visited; }, pool);
+        [[maybe_unused]] std::size_t totalLength = table.parallelReduce(std::size_t(0),
+            [](int, const std::string& value) { return value.size(); }, std::plus<>(), pool);
+        assert(visited == 1000 && totalLength == 2890 - 1 + 13); // lengths of "0" ~ "999" are 2890
+        try // a throwing task is rethrown only after all other tasks have finished with the caller's locals
+        {
+            std::atomic<std::size_t> visitedBeforeThrow = 0;
+            table.parallelForEach([&visitedBeforeThrow](int key, const std::string&) {
+                if (key == 0)
+                {
+                    throw std::runtime_error("key 0");
+                }
+                ++visitedBeforeThrow;
+            }, pool);
+            assert(false);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        assert(table.valueFor(0) == "0");
+        benchmarkBulkLoad(1 << 22, pool);
+    }
+
+    const int count = 1 << 20;
+    std::cout << "stripes of striped table: " << ThreadSafeLookupTable<int, int>::defaultStripeCount() << std::endl;
+    for (int threadCount : { 1, 4 })
+    {
+        benchmark<PerBucketLockLookupTable<int, int>>("per bucket", 1048573, count, threadCount, 2000000);
+        benchmark<ThreadSafeLookupTable<int, int>>("striped", 1048573, count, threadCount, 2000000);
+    }
+    return 0;
+}
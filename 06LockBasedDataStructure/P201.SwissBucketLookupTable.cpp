@@ -0,0 +1,409 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <bit>
+#include <cstdint>
+#include <cassert>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std::chrono_literals;
+
+// lookup table whose buckets are Swiss tables (the layout of abseil flat_hash_map), based on P201.FlatBucketLookupTable.cpp.
+// slots of a bucket are divided into groups of 16, every slot has a control byte:
+// empty (0x80), deleted (0xfe), or 7 bits of hash (0 ~ 0x7f) when it is full.
+// a probe loads the 16 control bytes of a group and compares them with the 7 bits of hash in one SSE2 instruction,
+// which gives a bit mask of candidate slots, only candidates have their keys compared.
+// a group with an empty slot ends the probe, so a miss usually costs one 16 bytes load and compare.
+// groups are probed by triangular numbers (1, 2, 3, ... groups further each time), which visits every group.
+// without SSE2 (or UseSimd = false) the mask is built by a scalar loop.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, bool UseSimd = true>
+class ThreadSafeLookupTable
+{
+private:
+    class BucketType
+    {
+        friend class ThreadSafeLookupTable<Key, Value, Hash, UseSimd>;
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        static constexpr std::size_t groupSize = 16;
+        static constexpr std::uint8_t emptyCtrl = 0x80;
+        static constexpr std::uint8_t deletedCtrl = 0xfe;
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+        std::vector<std::uint8_t> m_ctrl; // groupCount * groupSize
+        std::vector<BucketValue> m_slots;
+        std::size_t m_used; // full and deleted slots
+        mutable std::shared_mutex m_mutex;
+        static std::uint8_t h2(std::size_t hash)
+        {
+            return static_cast<std::uint8_t>(hash & 0x7f);
+        }
+        static std::size_t h1(std::size_t hash)
+        {
+            return hash >> 7;
+        }
+        // bit i is set if control byte i of the group equals value
+        static std::uint32_t match(const std::uint8_t* group, std::uint8_t value)
+        {
+#if defined(__SSE2__)
+            if constexpr (UseSimd)
+            {
+                const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+                return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(value)))));
+            }
+#endif
+            std::uint32_t mask = 0;
+            for (std::size_t i = 0; i < groupSize; ++i)
+            {
+                mask |= static_cast<std::uint32_t>(group[i] == value) << i;
+            }
+            return mask;
+        }
+        // bit i is set if slot i of the group is empty or deleted (control byte has the highest bit set)
+        static std::uint32_t matchEmptyOrDeleted(const std::uint8_t* group)
+        {
+#if defined(__SSE2__)
+            if constexpr (UseSimd)
+            {
+                return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+            }
+#endif
+            std::uint32_t mask = 0;
+            for (std::size_t i = 0; i < groupSize; ++i)
+            {
+                mask |= static_cast<std::uint32_t>(group[i] >> 7) << i;
+            }
+            return mask;
+        }
+        std::size_t groupMask() const
+        {
+            return m_ctrl.size() / groupSize - 1;
+        }
+        std::size_t findIndex(const Key& key, std::size_t hash) const
+        {
+            if (m_ctrl.empty())
+            {
+                return npos;
+            }
+            const std::size_t mask = groupMask();
+            std::size_t g = h1(hash) & mask;
+            for (std::size_t step = 1; ; g = (g + step++) & mask)
+            {
+                const std::uint8_t* group = &m_ctrl[g * groupSize];
+                for (std::uint32_t candidates = match(group, h2(hash)); candidates; candidates &= candidates - 1)
+                {
+                    const std::size_t index = g * groupSize + std::countr_zero(candidates);
+                    if (m_slots[index].first == key)
+                    {
+                        return index;
+                    }
+                }
+                if (match(group, emptyCtrl))
+                {
+                    return npos;
+                }
+            }
+        }
+        void rehash(std::size_t newGroupCount, const Hash& hasher)
+        {
+            std::vector<std::uint8_t> oldCtrl(newGroupCount * groupSize, emptyCtrl);
+            std::vector<BucketValue> oldSlots(newGroupCount * groupSize);
+            oldCtrl.swap(m_ctrl);
+            oldSlots.swap(m_slots);
+            m_used = 0;
+            for (std::size_t i = 0; i < oldCtrl.size(); ++i)
+            {
+                if (!(oldCtrl[i] & 0x80))
+                {
+                    insertNew(std::move(oldSlots[i]), mix(hasher(oldSlots[i].first)));
+                }
+            }
+        }
+        void insertNew(BucketValue&& item, std::size_t hash) // key must not exist, and there must be a free slot
+        {
+            const std::size_t mask = groupMask();
+            std::size_t g = h1(hash) & mask;
+            std::uint32_t free = matchEmptyOrDeleted(&m_ctrl[g * groupSize]);
+            for (std::size_t step = 1; !free; free = matchEmptyOrDeleted(&m_ctrl[g * groupSize]))
+            {
+                g = (g + step++) & mask;
+            }
+            const std::size_t index = g * groupSize + std::countr_zero(free);
+            if (m_ctrl[index] == emptyCtrl)
+            {
+                ++m_used;
+            }
+            m_ctrl[index] = h2(hash);
+            m_slots[index] = std::move(item);
+        }
+    public:
+        BucketType() : m_used(0) {}
+        Value valueFor(const Key& key, std::size_t hash, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex); // lock on shared mode.
+            const std::size_t index = findIndex(key, hash);
+            return index == npos ? defaultValue : m_slots[index].second;
+        }
+        void addOrUpdateMapping(const Key& key, std::size_t hash, const Value& value, const Hash& hasher)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            const std::size_t index = findIndex(key, hash);
+            if (index != npos) // found, modify
+            {
+                m_slots[index].second = value;
+                return;
+            }
+            if ((m_used + 1) * 8 > m_ctrl.size() * 7) // not found, grow (or clean deleted slots) if too full, then insert
+            {
+                const std::size_t size = std::count_if(m_ctrl.begin(), m_ctrl.end(), [](std::uint8_t c) { return !(c & 0x80); });
+                std::size_t newGroupCount = 1;
+                while (newGroupCount * groupSize < (size + 1) * 2)
+                {
+                    newGroupCount *= 2;
+                }
+                rehash(newGroupCount, hasher);
+            }
+            insertNew(BucketValue(key, value), hash);
+        }
+        void removeMapping(const Key& key, std::size_t hash)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            const std::size_t index = findIndex(key, hash);
+            if (index != npos) // found
+            {
+                m_ctrl[index] = deletedCtrl; // keep probe sequences of other keys unbroken
+                m_slots[index] = BucketValue();
+            }
+        }
+    };
+private:
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    // std::hash of integers is identity, mix the bits so that low bits (control byte, group) and high bits (bucket) are random
+    static std::size_t mix(std::size_t hash)
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(hash) ^ (static_cast<std::uint64_t>(hash) >> 29)) * 0x9E3779B97F4A7C15ull);
+    }
+    BucketType& getBucket(std::size_t hash) const
+    {
+        const std::size_t bucketIndex = (hash >> 32) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    using KeyType = Key;
+    using MappedType = Value;
+    using HashType = Hash;
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        return getBucket(hash).valueFor(key, hash, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        getBucket(hash).addOrUpdateMapping(key, hash, value, m_hasher);
+    }
+    void removeMapping(const Key& key)
+    {
+        const std::size_t hash = mix(m_hasher(key));
+        getBucket(hash).removeMapping(key, hash);
+    }
+    // get a snapshot of lookup table
+    std::map<Key, Value> getMap() const
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(m_buckets.size());
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            locks.emplace_back(m_buckets[i]->m_mutex);
+        }
+        std::map<Key, Value> res;
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            const BucketType& bucket = *m_buckets[i];
+            for (std::size_t j = 0; j < bucket.m_ctrl.size(); ++j)
+            {
+                if (!(bucket.m_ctrl[j] & 0x80))
+                {
+                    res.insert(bucket.m_slots[j]);
+                }
+            }
+        }
+        return res;
+    }
+};
+
+// from P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ListLookupTable
+{
+private:
+    class BucketType
+    {
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    ListLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ListLookupTable(const ListLookupTable&) = delete;
+    ListLookupTable& operator=(const ListLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+};
+
+// fill the table with count entries, then look up random keys on threadCount threads.
+// hit-heavy lookups only use keys in the table, miss-heavy lookups only use keys not in it.
+template<typename Table>
+double benchmark(std::size_t numBuckets, int count, bool hit, int threadCount, int lookupsPerThread)
+{
+    Table table(numBuckets);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    std::atomic<long long> hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                std::uint32_t x = 2463534242u + t; // xorshift
+                long long localHits = 0;
+                for (int i = 0; i < lookupsPerThread; ++i)
+                {
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    const int key = static_cast<int>(x % count) + (hit ? 0 : count);
+                    localHits += table.valueFor(key, -1) == key ? 1 : 0;
+                }
+                hits += localHits;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    assert(hits == (hit ? static_cast<long long>(lookupsPerThread) * threadCount : 0));
+    return static_cast<double>(lookupsPerThread) * threadCount / duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    ThreadSafeLookupTable<int, std::string> table(103);
+    for (int i = 0; i < 1000; ++i)
+    {
+        table.addOrUpdateMapping(i, std::to_string(i));
+        table.addOrUpdateMapping(i, std::to_string(i) + "_copy");
+    }
+    auto lookupFunc = [&table](int count) {
+        for (int i = 0; i < 100; ++i)
+        {
+            [[maybe_unused]] std::string value = table.valueFor(count * 100 + i);
+            assert(value == std::to_string(count * 100 + i) + "_copy");
+        }
+    };
+    {
+        std::vector<std::jthread> vec;
+        for (int i = 0; i < 10; ++i)
+        {
+            vec.emplace_back(lookupFunc, i);
+        }
+    }
+    for (int i = 0; i < 1000; i += 2)
+    {
+        table.removeMapping(i);
+    }
+    [[maybe_unused]] auto snapshot = table.getMap();
+    assert(snapshot.size() == 500 && snapshot.begin()->first == 1 && table.valueFor(2, "none") == "none");
+
+#if defined(__SSE2__)
+    std::cout << "SSE2 enabled" << std::endl;
+#else
+    std::cout << "SSE2 not available, both versions use the scalar match" << std::endl;
+#endif
+    const int count = 1 << 20;
+    const int lookups = 4000000;
+    std::cout << std::setw(12) << "workload" << std::setw(16) << "list(M/s)" << std::setw(16) << "scalar(M/s)" << std::setw(16) << "SSE2(M/s)" << std::endl;
+    for (bool hit : { true, false })
+    {
+        std::cout << std::setw(12) << (hit ? "hit-heavy" : "miss-heavy") << std::fixed << std::setprecision(2)
+            << std::setw(16) << benchmark<ListLookupTable<int, int>>(1048573, count, hit, 1, lookups)
+            << std::setw(16) << benchmark<ThreadSafeLookupTable<int, int, std::hash<int>, false>>(1031, count, hit, 1, lookups)
+            << std::setw(16) << benchmark<ThreadSafeLookupTable<int, int>>(1031, count, hit, 1, lookups) << std::endl;
+    }
+    return 0;
+}
@@ -6,59 +6,132 @@
 #include <shared_mutex>
 #include <chrono>
 #include <utility>
+#include <tuple>
 #include <algorithm>
 #include <list>
 #include <vector>
 #include <map>
 #include <string>
+#include <string_view>
+#include <functional>
+#include <span>
+#include <cstdint>
 #include <cassert>
 using namespace std::chrono_literals;
 
-template<typename Key, typename Value, typename Hash = std::hash<Key>>
+// Hash and KeyEqual can be transparent (both define is_transparent, like C++20 unordered containers),
+// then valueFor/visit/removeMapping accept any type comparable with Key, e.g. std::string_view for std::string keys,
+// without constructing a temporary Key.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
 class ThreadSafeLookupTable
 {
 private:
+    static constexpr bool isTransparent = requires {
+        typename Hash::is_transparent;
+        typename KeyEqual::is_transparent;
+    };
     class BucketType
     {
-        friend class ThreadSafeLookupTable<Key, Value, Hash>;
+        friend class ThreadSafeLookupTable<Key, Value, Hash, KeyEqual>;
     private:
-        using BucketValue = std::pair<Key, Value>;
+        // full hash is cached in the entry, most unequal keys are rejected without comparing them
+        struct BucketValue
+        {
+            std::size_t hash;
+            std::pair<Key, Value> item;
+            template<typename... Args>
+            BucketValue(std::size_t h, Args&&... args) : hash(h), item(std::forward<Args>(args)...) {}
+        };
         using BucketData = std::list<BucketValue>;
         using BucketIterator = typename BucketData::iterator;
         BucketData m_data;
         mutable std::shared_mutex m_mutex;
-        auto findEntryFor(const Key& key) const
+        [[no_unique_address]] KeyEqual m_equal;
+        template<typename K>
+        auto findEntryFor(std::size_t hash, const K& key) const
         {
-            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& entry) -> bool { return entry.hash == hash && m_equal(entry.item.first, key); });
         }
-        auto findEntryFor(const Key& key)
+        template<typename K>
+        auto findEntryFor(std::size_t hash, const K& key)
         {
-            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& entry) -> bool { return entry.hash == hash && m_equal(entry.item.first, key); });
         }
     public:
-        Value valueFor(const Key& key, const Value& defaultValue) const
+        BucketType(const KeyEqual& equal) : m_equal(equal) {}
+        template<typename K>
+        Value valueFor(std::size_t hash, const K& key, const Value& defaultValue) const
         {
             std::shared_lock<std::shared_mutex> lock(m_mutex); // lock on shared mode.
-            auto foundEntry = findEntryFor(key);
-            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+            auto foundEntry = findEntryFor(hash, key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->item.second;
         }
-        void addOrUpdateMapping(const Key& key, const Value& value)
+        template<typename K, typename Func>
+        bool visit(std::size_t hash, const K& key, Func&& func) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(hash, key);
+            if (foundEntry == m_data.end())
+            {
+                return false;
+            }
+            std::forward<Func>(func)(std::as_const(foundEntry->item.second));
+            return true;
+        }
+        template<typename K, typename V>
+        void addOrUpdateMapping(std::size_t hash, K&& key, V&& value)
         {
             std::lock_guard<std::shared_mutex> lock(m_mutex);
-            auto foundEntry = findEntryFor(key);
+            auto foundEntry = findEntryFor(hash, key);
             if (foundEntry == m_data.end()) // not found, insert
             {
-                m_data.emplace_back(key, value);
+                m_data.emplace_back(hash, std::forward<K>(key), std::forward<V>(value));
             }
             else // found, modify
             {
-                foundEntry->second = value;
+                foundEntry->item.second = std::forward<V>(value);
+            }
+        }
+        template<typename K, typename... Args>
+        bool emplace(std::size_t hash, K&& key, Args&&... args)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            if (findEntryFor(hash, key) != m_data.end())
+            {
+                return false;
+            }
+            m_data.emplace_back(hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+            return true;
+        }
+        template<typename K, typename Func>
+        bool upsert(std::size_t hash, K&& key, Func&& func)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(hash, key);
+            const bool inserted = foundEntry == m_data.end();
+            if (inserted)
+            {
+                foundEntry = m_data.emplace(m_data.end(), hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple());
+            }
+            std::forward<Func>(func)(foundEntry->item.second);
+            return inserted;
+        }
+        template<typename K, typename Factory>
+        bool computeIfAbsent(std::size_t hash, K&& key, Factory&& factory)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            if (findEntryFor(hash, key) != m_data.end())
+            {
+                return false;
             }
+            m_data.emplace_back(hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Factory>(factory)()));
+            return true;
         }
-        void removeMapping(const Key& key)
+        template<typename K>
+        void removeMapping(std::size_t hash, const K& key)
         {
             std::lock_guard<std::shared_mutex> lock(m_mutex);
-            auto foundEntry = findEntryFor(key);
+            auto foundEntry = findEntryFor(hash, key);
             if (foundEntry != m_data.end()) // found
             {
                 m_data.erase(foundEntry);
@@ -68,37 +141,202 @@ private:
 private:
     std::vector<std::unique_ptr<BucketType>> m_buckets;
     Hash m_hasher;
-    BucketType& getBucket(const Key& key) const
+    BucketType& getBucket(std::size_t hash) const
     {
-        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        const std::size_t bucketIndex = hash % m_buckets.size();
         return *m_buckets[bucketIndex];
     }
+    static void prefetch(const void* p)
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+    // an object may span two cache lines
+    template<typename T>
+    static void prefetchObject(const T* p)
+    {
+        prefetch(p);
+        prefetch(reinterpret_cast<const char*>(p) + sizeof(T) - 1);
+    }
 public:
     using KeyType = Key;
     using MappedType = Value;
     using HashType = Hash;
-    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash()) // numBuckets better be prime number
+    using KeyEqualType = KeyEqual;
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual()) // numBuckets better be prime number
         : m_buckets(numBuckets)
         , m_hasher(hasher)
     {
         for (std::size_t i = 0; i < numBuckets; ++i)
         {
-            m_buckets[i].reset(new BucketType());
+            m_buckets[i].reset(new BucketType(equal));
         }
     }
     ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
     ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
     Value valueFor(const Key& key, const Value& defaultValue = Value()) const
     {
-        return getBucket(key).valueFor(key, defaultValue);
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).valueFor(hash, key, defaultValue);
+    }
+    template<typename K> requires isTransparent
+    Value valueFor(const K& key, const Value& defaultValue = Value()) const
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).valueFor(hash, key, defaultValue);
+    }
+    // batched lookup, out[i] is set to value of keys[i].
+    // all keys are hashed first and grouped by bucket, every bucket is locked once per batch.
+    // then groups are resolved in a software pipeline, so the cache misses of different keys overlap
+    // instead of being paid one after another. while resolving group g:
+    // - the pointer to the bucket of group g + 3 * prefetchDistance is prefetched,
+    // - the bucket object of group g + 2 * prefetchDistance is prefetched,
+    // - the bucket of group g + prefetchDistance is locked (shared) and its first list node is prefetched.
+    // shared locks are taken in ascending bucket order like getMap, and writers only hold one lock, so no deadlock.
+    void valueForMany(std::span<const Key> keys, std::span<Value> out, const Value& defaultValue = Value()) const
+    {
+        static constexpr std::size_t prefetchDistance = 8;
+        assert(out.size() >= keys.size());
+        struct Request
+        {
+            std::size_t bucketIndex;
+            std::size_t hash;
+            std::size_t pos;
+        };
+        std::vector<Request> requests(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            const std::size_t hash = m_hasher(keys[i]);
+            requests[i] = { hash % m_buckets.size(), hash, i };
+        }
+        std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) { return a.bucketIndex < b.bucketIndex; });
+        std::vector<std::size_t> groups; // start of each group in requests, and the end
+        for (std::size_t i = 0; i < requests.size(); ++i)
+        {
+            if (i == 0 || requests[i].bucketIndex != requests[i - 1].bucketIndex)
+            {
+                groups.push_back(i);
+            }
+        }
+        const std::size_t groupCount = groups.size();
+        groups.push_back(requests.size());
+        auto bucketOf = [&](std::size_t group) -> const BucketType& {
+            return *m_buckets[requests[groups[group]].bucketIndex];
+        };
+        std::vector<std::shared_lock<std::shared_mutex>> locks(groupCount);
+        auto lockAhead = [&](std::size_t group) {
+            const BucketType& bucket = bucketOf(group);
+            locks[group] = std::shared_lock<std::shared_mutex>(bucket.m_mutex);
+            if (!bucket.m_data.empty())
+            {
+                prefetch(&bucket.m_data.front());
+            }
+        };
+        for (std::size_t group = 0; group < std::min(3 * prefetchDistance, groupCount); ++group)
+        {
+            prefetch(&m_buckets[requests[groups[group]].bucketIndex]);
+        }
+        for (std::size_t group = 0; group < std::min(2 * prefetchDistance, groupCount); ++group)
+        {
+            prefetchObject(&bucketOf(group));
+        }
+        for (std::size_t group = 0; group < std::min(prefetchDistance, groupCount); ++group)
+        {
+            lockAhead(group);
+        }
+        for (std::size_t group = 0; group < groupCount; ++group)
+        {
+            if (group + 3 * prefetchDistance < groupCount)
+            {
+                prefetch(&m_buckets[requests[groups[group + 3 * prefetchDistance]].bucketIndex]);
+            }
+            if (group + 2 * prefetchDistance < groupCount)
+            {
+                prefetchObject(&bucketOf(group + 2 * prefetchDistance));
+            }
+            if (group + prefetchDistance < groupCount)
+            {
+                lockAhead(group + prefetchDistance);
+            }
+            const BucketType& bucket = bucketOf(group);
+            for (std::size_t i = groups[group]; i < groups[group + 1]; ++i)
+            {
+                auto foundEntry = bucket.findEntryFor(requests[i].hash, keys[requests[i].pos]);
+                out[requests[i].pos] = (foundEntry == bucket.m_data.end()) ? defaultValue : foundEntry->item.second;
+            }
+            locks[group].unlock();
+        }
     }
     void addOrUpdateMapping(const Key& key, const Value& value)
     {
-        getBucket(key).addOrUpdateMapping(key, value);
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).addOrUpdateMapping(hash, key, value);
+    }
+    void addOrUpdateMapping(const Key& key, Value&& value)
+    {
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).addOrUpdateMapping(hash, key, std::move(value));
+    }
+    void addOrUpdateMapping(Key&& key, Value&& value)
+    {
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).addOrUpdateMapping(hash, std::move(key), std::move(value));
+    }
+    // run func(const Value&) on the stored value under shared lock of the bucket, without copying it out.
+    // return false if key is not found. func must not access the table.
+    template<typename Func>
+    bool visit(const Key& key, Func&& func) const
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).visit(hash, key, std::forward<Func>(func));
+    }
+    template<typename K, typename Func> requires isTransparent
+    bool visit(const K& key, Func&& func) const
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).visit(hash, key, std::forward<Func>(func));
+    }
+    // construct value from args in place if key is not found, return whether it is inserted.
+    template<typename... Args>
+    bool emplace(const Key& key, Args&&... args)
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).emplace(hash, key, std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    bool emplace(Key&& key, Args&&... args)
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).emplace(hash, std::move(key), std::forward<Args>(args)...);
+    }
+    // run func(Value&) on the stored value under exclusive lock, a default constructed value is inserted first
+    // if key is not found. return whether it is inserted.
+    template<typename Func>
+    bool upsert(const Key& key, Func&& func)
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).upsert(hash, key, std::forward<Func>(func));
+    }
+    // insert factory() only if key is not found, factory is not called otherwise. return whether it is inserted.
+    template<typename Factory>
+    bool computeIfAbsent(const Key& key, Factory&& factory)
+    {
+        const std::size_t hash = m_hasher(key);
+        return getBucket(hash).computeIfAbsent(hash, key, std::forward<Factory>(factory));
     }
     void removeMapping(const Key& key)
     {
-        getBucket(key).removeMapping(key);
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).removeMapping(hash, key);
+    }
+    template<typename K> requires isTransparent
+    void removeMapping(const K& key)
+    {
+        const std::size_t hash = m_hasher(key);
+        getBucket(hash).removeMapping(hash, key);
     }
     // get a snapshot of lookup table
     std::map<Key, Value> getMap() const
@@ -107,20 +345,130 @@ public:
         locks.reserve(m_buckets.size());
         for (std::size_t i = 0; i < m_buckets.size(); ++i)
         {
-            locks.emplace_back(m_buckets[i].m_mutex);
+            locks.emplace_back(m_buckets[i]->m_mutex);
         }
         std::map<Key, Value> res;
         for (std::size_t i = 0; i < m_buckets.size(); ++i)
         {
-            for (auto iter = m_buckets[i].data.begin(); iter != m_buckets[i].data.end(); ++iter)
+            for (auto iter = m_buckets[i]->m_data.begin(); iter != m_buckets[i]->m_data.end(); ++iter)
             {
-                res.insert(*iter);
+                res.insert(iter->item);
             }
         }
         return res;
     }
 };
 
+// values are 4KB strings: valueFor allocates and copies each of them, visit only reads it in place.
+void benchmarkLargeValues(int count, int lookups)
+{
+    ThreadSafeLookupTable<int, std::string> table(1031);
+    for (int i = 0; i < count; ++i)
+    {
+        table.emplace(i, 4096, static_cast<char>('a' + i % 26));
+    }
+    auto measure = [&](auto lookup) {
+        long long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i)
+        {
+            sum += lookup(i % count);
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        assert(sum > 0);
+        return static_cast<double>(duration) / lookups;
+    };
+    double copy = measure([&](int key) { return table.valueFor(key).back(); });
+    double inPlace = measure([&](int key) {
+        char c = 0;
+        table.visit(key, [&c](const std::string& value) { c = value.back(); });
+        return c;
+    });
+    std::cout << "4KB values : valueFor " << std::fixed << std::setprecision(2) << copy << "ns/lookup, visit " << inPlace << "ns/lookup" << std::endl;
+}
+
+// transparent hash for std::string keys, hashes std::string, std::string_view and const char* alike
+struct StringHash
+{
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const
+    {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+// keys are long strings (no small string optimization), lookups arrive as std::string_view slices of a buffer.
+void benchmarkStringViewLookup(int count, int lookups)
+{
+    ThreadSafeLookupTable<std::string, int, StringHash, std::equal_to<>> table(1031);
+    std::string buffer;
+    for (int i = 0; i < count; ++i)
+    {
+        std::string key = "/api/v1/resources/" + std::to_string(1000000 + i) + "/items";
+        buffer += key;
+        table.addOrUpdateMapping(std::move(key), i);
+    }
+    const std::size_t keyLength = buffer.size() / count;
+    auto measure = [&](auto lookup) {
+        long long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i)
+        {
+            sum += lookup(std::string_view(buffer).substr(i % count * keyLength, keyLength));
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        assert(sum == static_cast<long long>(lookups / count) * count * (count - 1) / 2);
+        return static_cast<double>(duration) / lookups;
+    };
+    double temporary = measure([&](std::string_view key) { return table.valueFor(std::string(key), -1); });
+    double transparent = measure([&](std::string_view key) { return table.valueFor(key, -1); });
+    std::cout << "string_view keys : temporary std::string " << std::fixed << std::setprecision(2) << temporary
+        << "ns/lookup, transparent " << transparent << "ns/lookup" << std::endl;
+}
+
+// table is much larger than last level cache, look up random keys in batches, compared with calling valueFor one by one.
+void benchmarkBatchLookup(int count, std::size_t batchSize, int batches)
+{
+    ThreadSafeLookupTable<int, int> table(count / 2 * 2 + 1);
+    for (int i = 0; i < count; ++i)
+    {
+        table.addOrUpdateMapping(i, i);
+    }
+    std::vector<int> keys(batchSize);
+    std::vector<int> values(batchSize);
+    std::uint32_t x = 2463534242u; // xorshift
+    auto nextBatch = [&]() {
+        for (auto& key : keys)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            key = static_cast<int>(x % count);
+        }
+    };
+    auto measure = [&](auto lookupBatch) {
+        x = 2463534242u;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batches; ++i)
+        {
+            nextBatch();
+            lookupBatch();
+            assert(values == keys);
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return static_cast<double>(duration) / (static_cast<double>(batches) * batchSize);
+    };
+    double single = measure([&]() {
+        for (std::size_t i = 0; i < batchSize; ++i)
+        {
+            values[i] = table.valueFor(keys[i], -1);
+        }
+    });
+    double batched = measure([&]() { table.valueForMany(keys, values, -1); });
+    std::cout << count << " entries, batch of " << std::setw(4) << batchSize << " : valueFor " << std::fixed << std::setprecision(2)
+        << single << "ns/key, valueForMany " << batched << "ns/key" << std::endl;
+}
+
 int main(int argc, char const *argv[])
 {
     ThreadSafeLookupTable<int, std::string> table(103);
@@ -145,5 +493,49 @@ int main(int argc, char const *argv[])
             vec.emplace_back(lookupFunc, i);
         }
     }
+    assert(table.getMap().size() == 100);
+
+    // in-place access, values are never copied out
+    std::size_t length = 0;
+    [[maybe_unused]] bool found = table.visit(1, [&length](const std::string& value) { length = value.size(); });
+    assert(found && length == 6);
+    found = table.visit(1000, [](const std::string&) {});
+    assert(!found);
+    [[maybe_unused]] bool inserted = table.emplace(1, 3, 'x');
+    assert(!inserted);
+    inserted = table.emplace(100, 3, 'x');
+    assert(inserted && table.valueFor(100) == "xxx");
+    inserted = table.upsert(100, [](std::string& value) { value += "_copy"; });
+    assert(!inserted && table.valueFor(100) == "xxx_copy");
+    inserted = table.upsert(101, [](std::string& value) { value = "new"; });
+    assert(inserted && table.valueFor(101) == "new");
+    int factoryCalls = 0;
+    auto factory = [&factoryCalls]() { ++factoryCalls; return std::string(100, 'y'); };
+    [[maybe_unused]] bool first = table.computeIfAbsent(102, factory);
+    [[maybe_unused]] bool second = table.computeIfAbsent(102, factory);
+    assert(first && !second && factoryCalls == 1);
+    std::string large(4096, 'z');
+    table.addOrUpdateMapping(103, std::move(large));
+    benchmarkLargeValues(1000, 1000000);
+
+    // heterogeneous lookup with transparent hash and equality
+    ThreadSafeLookupTable<std::string, int, StringHash, std::equal_to<>> names;
+    names.addOrUpdateMapping("alice", 1);
+    names.addOrUpdateMapping("bob", 2);
+    [[maybe_unused]] std::string_view message = "hello bob!";
+    assert(names.valueFor(message.substr(6, 3), -1) == 2 && names.valueFor("alice", -1) == 1);
+    names.removeMapping(std::string_view("alice"));
+    assert(names.valueFor(std::string("alice"), -1) == -1);
+    benchmarkStringViewLookup(1000, 1000000);
+
+    // batched lookup
+    std::vector<int> keys { 3, 1000, 5, 3 };
+    std::vector<std::string> values(keys.size());
+    table.valueForMany(keys, values, "none");
+    assert(values[0] == "3_copy" && values[1] == "none" && values[2] == "5_copy" && values[3] == "3_copy");
+    for (std::size_t batchSize : { 64, 1024 })
+    {
+        benchmarkBatchLookup(1 << 22, batchSize, (1 << 20) / static_cast<int>(batchSize));
+    }
     return 0;
 }
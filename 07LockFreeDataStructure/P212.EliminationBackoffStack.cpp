@@ -0,0 +1,544 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stack>
+#include <optional>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <random>
+#include <functional>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// from P220.HazardPointerDomain.cpp
+// 1. reading a shared pointer through HazardPointer::protect before dereferencing it,
+// 2. passing a node to HazardPointerDomain::retire instead of deleting it after unlinking it.
+//
+// memory overhead (H = maxThreads * slotsPerThread, N = count of threads):
+// - slots: one cache line per thread record, maxThreads records at all.
+// - every thread scans all slots once it has retired threshold = 2 * H nodes, at most H of them survive a scan,
+//   so one thread holds less than 3 * H unreclaimed nodes, the whole domain holds O(N * H).
+// - nodes left by exited threads are adopted by the next scan of any thread.
+class HazardPointerDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t slotsPerThread = 4;
+private:
+    struct alignas(64) Record // one record per thread, avoid false sharing between threads
+    {
+        std::atomic<bool> active { false };
+        std::atomic<const void*> slots[slotsPerThread] {};
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+    };
+    // state of current thread, acquire a record on first use, and release it on thread exit.
+    class ThreadState
+    {
+        friend class HazardPointerDomain;
+        HazardPointerDomain& domain;
+        Record* record;
+        unsigned usedSlots; // bit mask
+        std::vector<RetiredPointer> retired;
+        std::vector<const void*> hazards; // reused by scan
+    public:
+        ThreadState(HazardPointerDomain& d) : domain(d), record(d.acquireRecord()), usedSlots(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            for (auto& slot : record->slots)
+            {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+            record->active.store(false, std::memory_order_release);
+            domain.scan(*this);
+            domain.orphan(retired);
+        }
+    };
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount; // high water mark of used records, scan only needs to read them
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans; // retired nodes of exited threads
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].active.load(std::memory_order_relaxed) && records[i].active.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    std::size_t threshold() const
+    {
+        return 2 * recordCount.load(std::memory_order_relaxed) * slotsPerThread;
+    }
+    void orphan(std::vector<RetiredPointer>& retired)
+    {
+        if (!retired.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+            retired.clear();
+        }
+    }
+    void scan(ThreadState& state)
+    {
+        {
+            std::unique_lock lock(orphanMutex, std::try_to_lock); // adopt nodes of exited threads
+            if (lock.owns_lock() && !orphans.empty())
+            {
+                state.retired.insert(state.retired.end(), orphans.begin(), orphans.end());
+                orphans.clear();
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pair with protect: either reader sees the node unlinked, or we see its hazard pointer
+        state.hazards.clear();
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (const auto& slot : records[i].slots)
+            {
+                if (const void* p = slot.load(std::memory_order_acquire))
+                {
+                    state.hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(state.hazards.begin(), state.hazards.end());
+        auto stillHazardous = std::partition(state.retired.begin(), state.retired.end(), [&](const RetiredPointer& r) {
+            return std::binary_search(state.hazards.begin(), state.hazards.end(), r.pointer);
+        });
+        for (auto iter = stillHazardous; iter != state.retired.end(); ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(state.retired.end() - stillHazardous, std::memory_order_relaxed);
+        state.retired.erase(stillHazardous, state.retired.end());
+    }
+    HazardPointerDomain() : recordCount(0), reclaimedCount(0) {}
+public:
+    HazardPointerDomain(const HazardPointerDomain&) = delete;
+    HazardPointerDomain& operator=(const HazardPointerDomain&) = delete;
+    ~HazardPointerDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static HazardPointerDomain& instance()
+    {
+        static HazardPointerDomain domain;
+        return domain;
+    }
+    // acquire/release a slot of current thread, used by HazardPointer
+    std::atomic<const void*>* acquireSlot()
+    {
+        ThreadState& state = threadState();
+        for (std::size_t i = 0; i < slotsPerThread; ++i)
+        {
+            if (!(state.usedSlots & (1u << i)))
+            {
+                state.usedSlots |= (1u << i);
+                return &state.record->slots[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer slots available in current thread");
+    }
+    void releaseSlot(std::atomic<const void*>* slot)
+    {
+        ThreadState& state = threadState();
+        slot->store(nullptr, std::memory_order_release);
+        state.usedSlots &= ~(1u << (slot - state.record->slots));
+    }
+    // p must have been unlinked from the data structure, it will be deleted when no hazard pointer points to it.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        state.retired.push_back({ p, deleter });
+        if (state.retired.size() >= threshold())
+        {
+            scan(state);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// RAII owner of a hazard pointer slot of current thread.
+class HazardPointer
+{
+    std::atomic<const void*>* slot;
+public:
+    HazardPointer() : slot(HazardPointerDomain::instance().acquireSlot()) {}
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+    ~HazardPointer()
+    {
+        HazardPointerDomain::instance().releaseSlot(slot);
+    }
+    // publish ptr, then check src still holds it. on failure ptr is updated to the new value of src.
+    template<typename T>
+    bool tryProtect(T*& ptr, const std::atomic<T*>& src)
+    {
+        T* p = ptr;
+        slot->store(p, std::memory_order_seq_cst); // store-load order: must be visible before src is re-read
+        ptr = src.load(std::memory_order_seq_cst);
+        if (ptr != p)
+        {
+            slot->store(nullptr, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    // returned pointer is safe to dereference until resetProtection or destruction.
+    template<typename T>
+    T* protect(const std::atomic<T*>& src)
+    {
+        T* p = src.load(std::memory_order_relaxed);
+        while (!tryProtect(p, src))
+        {
+        }
+        return p;
+    }
+    // publish a pointer which is already known to be safe (e.g. protected by another hazard pointer)
+    template<typename T>
+    void resetProtection(const T* p)
+    {
+        slot->store(p, std::memory_order_seq_cst);
+    }
+    void resetProtection()
+    {
+        slot->store(nullptr, std::memory_order_release);
+    }
+};
+
+// from P212.LockFreeStack.cpp
+// Treiber lock-free stack:
+// push/pop replace head by CAS, a popped node is retired to hazard pointer domain instead of being deleted.
+// ABA: pop reads head A and A->next B, then CAS(head, A -> B). If meanwhile A was popped, deleted and a new node
+// reused the same address, CAS would succeed with a stale B. A protected A can not be deleted, so it can not be reused.
+// data is stored in node directly, pop moves it out to std::optional<T> without allocation.
+template<typename T>
+class LockFreeStack
+{
+private:
+    struct node
+    {
+        T data;
+        node* next;
+        node(T&& value) : data(std::move(value)), next(nullptr) {}
+    };
+    std::atomic<node*> head;
+public:
+    LockFreeStack() : head(nullptr) {}
+    LockFreeStack(const LockFreeStack&) = delete;
+    LockFreeStack& operator=(const LockFreeStack&) = delete;
+    ~LockFreeStack()
+    {
+        node* p = head.load();
+        while (p)
+        {
+            node* next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+    void push(T value)
+    {
+        node* newNode = new node(std::move(value));
+        newNode->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(newNode->next, newNode, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    std::optional<T> pop()
+    {
+        HazardPointer hp;
+        node* oldHead = hp.protect(head);
+        while (oldHead && !head.compare_exchange_strong(oldHead, oldHead->next))
+        {
+            oldHead = hp.protect(head);
+        }
+        hp.resetProtection();
+        if (!oldHead)
+        {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(oldHead->data)); // only current thread accesses data of popped node
+        HazardPointerDomain::instance().retire(oldHead);
+        return res;
+    }
+    bool empty() const
+    {
+        return head.load() == nullptr;
+    }
+};
+
+// elimination backoff stack: Treiber stack (P212.LockFreeStack.cpp) with an elimination array.
+// when CAS on head fails because of contention, instead of retrying immediately:
+// - push offers its node in a random slot of the elimination array and waits for a while,
+// - pop looks at a random slot, and takes the node offered there.
+// a push and a pop which meet in the array cancel each other out without touching head.
+// the offered node is protected by a hazard pointer of the pushing thread, so it can not be reused while it is offered.
+template<typename T>
+class EliminationBackoffStack
+{
+private:
+    struct node
+    {
+        T data;
+        node* next;
+        node(T&& value) : data(std::move(value)), next(nullptr) {}
+    };
+    static constexpr std::size_t maxWidth = 16;
+    static constexpr int spinCount = 256; // how long a push waits in a slot
+    struct alignas(64) Slot
+    {
+        std::atomic<node*> offer { nullptr };
+    };
+    std::atomic<node*> head;
+    Slot slots[maxWidth];
+    std::atomic<std::size_t> eliminatedCount;
+    // adaptive width of used part of elimination array, per thread:
+    // double it when the chosen slot is busy (many collisions), halve it when nobody comes (few collisions).
+    static std::size_t& width()
+    {
+        thread_local static std::size_t w = 1;
+        return w;
+    }
+    static std::size_t randomSlot()
+    {
+        thread_local static std::minstd_rand engine(static_cast<unsigned>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        return engine() % width();
+    }
+    bool tryPush(node* newNode)
+    {
+        newNode->next = head.load(std::memory_order_relaxed);
+        return head.compare_exchange_strong(newNode->next, newNode, std::memory_order_release, std::memory_order_relaxed);
+    }
+    // return false if CAS failed because of contention, set oldHead to nullptr if stack is empty.
+    bool tryPop(node*& oldHead, HazardPointer& hp)
+    {
+        oldHead = hp.protect(head);
+        return !oldHead || head.compare_exchange_strong(oldHead, oldHead->next);
+    }
+    bool eliminatePush(node* newNode, HazardPointer& hp)
+    {
+        std::atomic<node*>& offer = slots[randomSlot()].offer;
+        node* expected = nullptr;
+        hp.resetProtection(newNode); // keep the node from being reused while it is offered
+        if (!offer.compare_exchange_strong(expected, newNode, std::memory_order_release, std::memory_order_relaxed))
+        {
+            width() = std::min(width() * 2, maxWidth);
+            return false;
+        }
+        for (int i = 0; i < spinCount; ++i)
+        {
+            if (offer.load(std::memory_order_acquire) != newNode) // taken by a pop
+            {
+                hp.resetProtection();
+                return true;
+            }
+        }
+        expected = newNode;
+        if (offer.compare_exchange_strong(expected, nullptr, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            width() = std::max<std::size_t>(width() / 2, 1); // withdrawn, nobody came
+            hp.resetProtection();
+            return false;
+        }
+        hp.resetProtection(); // taken just before withdrawn
+        return true;
+    }
+    node* eliminatePop()
+    {
+        std::atomic<node*>& offer = slots[randomSlot()].offer;
+        node* p = offer.load(std::memory_order_acquire);
+        if (p && offer.compare_exchange_strong(p, nullptr, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            eliminatedCount.fetch_add(1, std::memory_order_relaxed);
+            return p;
+        }
+        return nullptr;
+    }
+    std::optional<T> take(node* p)
+    {
+        std::optional<T> res(std::move(p->data));
+        HazardPointerDomain::instance().retire(p); // the pushing thread may still be reading its hazard pointer
+        return res;
+    }
+public:
+    EliminationBackoffStack() : head(nullptr), eliminatedCount(0) {}
+    EliminationBackoffStack(const EliminationBackoffStack&) = delete;
+    EliminationBackoffStack& operator=(const EliminationBackoffStack&) = delete;
+    ~EliminationBackoffStack()
+    {
+        node* p = head.load();
+        while (p)
+        {
+            node* next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+    void push(T value)
+    {
+        node* newNode = new node(std::move(value));
+        HazardPointer hp;
+        while (!tryPush(newNode) && !eliminatePush(newNode, hp))
+        {
+        }
+    }
+    std::optional<T> pop()
+    {
+        HazardPointer hp;
+        node* oldHead = nullptr;
+        for (;;)
+        {
+            if (tryPop(oldHead, hp))
+            {
+                hp.resetProtection();
+                return oldHead ? take(oldHead) : std::nullopt;
+            }
+            if (node* p = eliminatePop())
+            {
+                hp.resetProtection();
+                return take(p);
+            }
+        }
+    }
+    bool empty() const
+    {
+        return head.load() == nullptr;
+    }
+    std::size_t eliminated() const
+    {
+        return eliminatedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// from 03ShareData/P49.ThreadSafeStack.cpp, for comparison
+struct empty_stack : std::exception
+{
+    virtual const char* what() const noexcept override
+    {
+        return "threadsafe_stack is empty!";
+    }
+};
+
+template<typename T>
+class threadsafe_stack
+{
+private:
+    std::stack<T> data;
+    mutable std::mutex m;
+public:
+    threadsafe_stack() {}
+    threadsafe_stack& operator=(const threadsafe_stack& other) = delete;
+    void push(T new_value)
+    {
+        std::lock_guard lock(m);
+        data.push(std::move(new_value));
+    }
+    std::shared_ptr<T> pop()
+    {
+        std::lock_guard lock(m);
+        if (data.empty())
+        {
+            throw empty_stack();
+        }
+        const std::shared_ptr<T> res(std::make_shared<T>(std::move(data.top())));
+        data.pop();
+        return res;
+    }
+    bool empty() const
+    {
+        std::lock_guard lock(m);
+        return data.empty();
+    }
+};
+
+// benchmark: balanced bursts, every thread pushes burst values then pops burst values.
+// a thread pops only after its own pushes, so a pop never finds the stack empty.
+template<typename Stack>
+long long benchmark(Stack& S, int threadCount, int totalOps, int burst)
+{
+    std::atomic<long long> sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([&S, &sum, burst, rounds = totalOps / threadCount / burst]() {
+                long long localSum = 0;
+                for (int j = 0; j < rounds; ++j)
+                {
+                    for (int k = 0; k < burst; ++k)
+                    {
+                        S.push(k);
+                    }
+                    for (int k = 0; k < burst; ++k)
+                    {
+                        localSum += *S.pop();
+                    }
+                }
+                sum += localSum;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    assert(S.empty() && sum == static_cast<long long>(threadCount) * (totalOps / threadCount / burst) * (burst - 1) * burst / 2);
+    return duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    const int totalOps = 1 << 20;
+    const int burst = 8;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "mutex(us)" << std::setw(16) << "treiber(us)"
+        << std::setw(20) << "elimination(us)" << std::setw(14) << "eliminated" << std::endl;
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 2)
+    {
+        threadsafe_stack<int> S0;
+        LockFreeStack<int> S1;
+        EliminationBackoffStack<int> S2;
+        std::cout << std::setw(8) << threadCount
+            << std::setw(12) << benchmark(S0, threadCount, totalOps, burst)
+            << std::setw(16) << benchmark(S1, threadCount, totalOps, burst)
+            << std::setw(20) << benchmark(S2, threadCount, totalOps, burst)
+            << std::setw(14) << S2.eliminated() << std::endl;
+    }
+    return 0;
+}
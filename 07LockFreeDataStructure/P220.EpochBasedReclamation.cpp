@@ -0,0 +1,595 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// epoch based reclamation (EBR):
+// readers only announce the global epoch once when entering a critical section (EpochGuard), not once per node.
+// a node retired in epoch e is deleted when global epoch reaches e + 2,
+// global epoch can only advance when every thread in critical section has announced the current epoch,
+// so all readers which might have seen the node have exited.
+// cost: a stalled reader blocks all reclamation, hazard pointers do not have this problem.
+class EpochDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t advanceInterval = 64; // try to advance epoch once per advanceInterval retires
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<bool> used { false };
+        std::atomic<std::uint64_t> state { 0 }; // (epoch << 1) | 1 when in critical section, 0 when quiescent
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+        std::uint64_t epoch;
+    };
+    class ThreadState
+    {
+        friend class EpochDomain;
+        EpochDomain& domain;
+        Record* record;
+        unsigned nesting;
+        std::vector<RetiredPointer> limbo; // ordered by epoch
+        std::size_t retiredSinceAdvance;
+    public:
+        ThreadState(EpochDomain& d) : domain(d), record(d.acquireRecord()), nesting(0), retiredSinceAdvance(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            record->state.store(0, std::memory_order_release);
+            record->used.store(false, std::memory_order_release);
+            domain.tryAdvance();
+            domain.reclaim(limbo);
+            domain.orphan(limbo);
+        }
+    };
+    std::atomic<std::uint64_t> globalEpoch;
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount;
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans;
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].used.load(std::memory_order_relaxed) && records[i].used.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No epoch records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    // advance global epoch if every thread in critical section has announced it.
+    void tryAdvance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::uint64_t s = records[i].state.load(std::memory_order_acquire);
+            if ((s & 1) && (s >> 1) != epoch)
+            {
+                return;
+            }
+        }
+        globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+    void reclaim(std::vector<RetiredPointer>& limbo)
+    {
+        const std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        auto safeEnd = std::find_if(limbo.begin(), limbo.end(), [epoch](const RetiredPointer& r) { return r.epoch + 2 > epoch; });
+        for (auto iter = limbo.begin(); iter != safeEnd; ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(safeEnd - limbo.begin(), std::memory_order_relaxed);
+        limbo.erase(limbo.begin(), safeEnd);
+    }
+    void orphan(std::vector<RetiredPointer>& limbo)
+    {
+        if (!limbo.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), limbo.begin(), limbo.end());
+            limbo.clear();
+        }
+    }
+    void adoptOrphans(std::vector<RetiredPointer>& limbo)
+    {
+        std::unique_lock lock(orphanMutex, std::try_to_lock);
+        if (lock.owns_lock() && !orphans.empty())
+        {
+            limbo.insert(limbo.end(), orphans.begin(), orphans.end());
+            orphans.clear();
+            std::stable_sort(limbo.begin(), limbo.end(), [](const RetiredPointer& a, const RetiredPointer& b) { return a.epoch < b.epoch; });
+        }
+    }
+    EpochDomain() : globalEpoch(1), recordCount(0), reclaimedCount(0) {}
+public:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+    ~EpochDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static EpochDomain& instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+    void enter()
+    {
+        ThreadState& state = threadState();
+        if (state.nesting++ == 0)
+        {
+            state.record->state.store((globalEpoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // announce before reading any shared pointer, once per critical section
+        }
+    }
+    void exit()
+    {
+        ThreadState& state = threadState();
+        if (--state.nesting == 0)
+        {
+            state.record->state.store(0, std::memory_order_release);
+        }
+    }
+    // p must have been unlinked from the data structure.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        // order the caller's unlink before reading the epoch, otherwise the load may return an older epoch
+        // while a reader which entered in the newer one still holds p, and p would be freed one epoch too early.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        state.limbo.push_back({ p, deleter, globalEpoch.load(std::memory_order_acquire) });
+        if (++state.retiredSinceAdvance >= advanceInterval)
+        {
+            state.retiredSinceAdvance = 0;
+            adoptOrphans(state.limbo);
+            tryAdvance();
+            reclaim(state.limbo);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+class EpochGuard
+{
+public:
+    EpochGuard()
+    {
+        EpochDomain::instance().enter();
+    }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+    ~EpochGuard()
+    {
+        EpochDomain::instance().exit();
+    }
+};
+
+// from P220.HazardPointerDomain.cpp
+// 1. reading a shared pointer through HazardPointer::protect before dereferencing it,
+// 2. passing a node to HazardPointerDomain::retire instead of deleting it after unlinking it.
+//
+// memory overhead (H = maxThreads * slotsPerThread, N = count of threads):
+// - slots: one cache line per thread record, maxThreads records at all.
+// - every thread scans all slots once it has retired threshold = 2 * H nodes, at most H of them survive a scan,
+//   so one thread holds less than 3 * H unreclaimed nodes, the whole domain holds O(N * H).
+// - nodes left by exited threads are adopted by the next scan of any thread.
+class HazardPointerDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t slotsPerThread = 4;
+private:
+    struct alignas(64) Record // one record per thread, avoid false sharing between threads
+    {
+        std::atomic<bool> active { false };
+        std::atomic<const void*> slots[slotsPerThread] {};
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+    };
+    // state of current thread, acquire a record on first use, and release it on thread exit.
+    class ThreadState
+    {
+        friend class HazardPointerDomain;
+        HazardPointerDomain& domain;
+        Record* record;
+        unsigned usedSlots; // bit mask
+        std::vector<RetiredPointer> retired;
+        std::vector<const void*> hazards; // reused by scan
+    public:
+        ThreadState(HazardPointerDomain& d) : domain(d), record(d.acquireRecord()), usedSlots(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            for (auto& slot : record->slots)
+            {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+            record->active.store(false, std::memory_order_release);
+            domain.scan(*this);
+            domain.orphan(retired);
+        }
+    };
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount; // high water mark of used records, scan only needs to read them
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans; // retired nodes of exited threads
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].active.load(std::memory_order_relaxed) && records[i].active.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    std::size_t threshold() const
+    {
+        return 2 * recordCount.load(std::memory_order_relaxed) * slotsPerThread;
+    }
+    void orphan(std::vector<RetiredPointer>& retired)
+    {
+        if (!retired.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+            retired.clear();
+        }
+    }
+    void scan(ThreadState& state)
+    {
+        {
+            std::unique_lock lock(orphanMutex, std::try_to_lock); // adopt nodes of exited threads
+            if (lock.owns_lock() && !orphans.empty())
+            {
+                state.retired.insert(state.retired.end(), orphans.begin(), orphans.end());
+                orphans.clear();
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pair with protect: either reader sees the node unlinked, or we see its hazard pointer
+        state.hazards.clear();
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (const auto& slot : records[i].slots)
+            {
+                if (const void* p = slot.load(std::memory_order_acquire))
+                {
+                    state.hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(state.hazards.begin(), state.hazards.end());
+        auto stillHazardous = std::partition(state.retired.begin(), state.retired.end(), [&](const RetiredPointer& r) {
+            return std::binary_search(state.hazards.begin(), state.hazards.end(), r.pointer);
+        });
+        for (auto iter = stillHazardous; iter != state.retired.end(); ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(state.retired.end() - stillHazardous, std::memory_order_relaxed);
+        state.retired.erase(stillHazardous, state.retired.end());
+    }
+    HazardPointerDomain() : recordCount(0), reclaimedCount(0) {}
+public:
+    HazardPointerDomain(const HazardPointerDomain&) = delete;
+    HazardPointerDomain& operator=(const HazardPointerDomain&) = delete;
+    ~HazardPointerDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static HazardPointerDomain& instance()
+    {
+        static HazardPointerDomain domain;
+        return domain;
+    }
+    // acquire/release a slot of current thread, used by HazardPointer
+    std::atomic<const void*>* acquireSlot()
+    {
+        ThreadState& state = threadState();
+        for (std::size_t i = 0; i < slotsPerThread; ++i)
+        {
+            if (!(state.usedSlots & (1u << i)))
+            {
+                state.usedSlots |= (1u << i);
+                return &state.record->slots[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer slots available in current thread");
+    }
+    void releaseSlot(std::atomic<const void*>* slot)
+    {
+        ThreadState& state = threadState();
+        slot->store(nullptr, std::memory_order_release);
+        state.usedSlots &= ~(1u << (slot - state.record->slots));
+    }
+    // p must have been unlinked from the data structure, it will be deleted when no hazard pointer points to it.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        state.retired.push_back({ p, deleter });
+        if (state.retired.size() >= threshold())
+        {
+            scan(state);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// RAII owner of a hazard pointer slot of current thread.
+class HazardPointer
+{
+    std::atomic<const void*>* slot;
+public:
+    HazardPointer() : slot(HazardPointerDomain::instance().acquireSlot()) {}
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+    ~HazardPointer()
+    {
+        HazardPointerDomain::instance().releaseSlot(slot);
+    }
+    // publish ptr, then check src still holds it. on failure ptr is updated to the new value of src.
+    template<typename T>
+    bool tryProtect(T*& ptr, const std::atomic<T*>& src)
+    {
+        T* p = ptr;
+        slot->store(p, std::memory_order_seq_cst); // store-load order: must be visible before src is re-read
+        ptr = src.load(std::memory_order_seq_cst);
+        if (ptr != p)
+        {
+            slot->store(nullptr, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    // returned pointer is safe to dereference until resetProtection or destruction.
+    template<typename T>
+    T* protect(const std::atomic<T*>& src)
+    {
+        T* p = src.load(std::memory_order_relaxed);
+        while (!tryProtect(p, src))
+        {
+        }
+        return p;
+    }
+    // publish a pointer which is already known to be safe (e.g. protected by another hazard pointer)
+    template<typename T>
+    void resetProtection(const T* p)
+    {
+        slot->store(p, std::memory_order_seq_cst);
+    }
+    void resetProtection()
+    {
+        slot->store(nullptr, std::memory_order_release);
+    }
+};
+
+// read-mostly sorted list: readers traverse without lock, writers are serialized by a mutex and replace nodes.
+// a removed node has its next pointer marked (lowest bit) before being unlinked,
+// so a hazard pointer reader can detect that its predecessor has been removed and restart.
+template<bool UseEpoch>
+class ReadMostlyList
+{
+    struct Node
+    {
+        int key;
+        std::atomic<std::uintptr_t> next;
+        Node(int k, std::uintptr_t n) : key(k), next(n) {}
+    };
+    static constexpr std::uintptr_t markBit = 1;
+    static Node* toNode(std::uintptr_t p)
+    {
+        return reinterpret_cast<Node*>(p & ~markBit);
+    }
+    static std::uintptr_t fromNode(Node* p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p);
+    }
+    std::atomic<std::uintptr_t> head;
+    std::mutex writeMutex;
+    static void retire(Node* p)
+    {
+        if constexpr (UseEpoch)
+        {
+            EpochDomain::instance().retire(p);
+        }
+        else
+        {
+            HazardPointerDomain::instance().retire(p);
+        }
+    }
+public:
+    ReadMostlyList(int size) : head(0)
+    {
+        for (int key = size - 1; key >= 0; --key)
+        {
+            head.store(fromNode(new Node(key, head.load())));
+        }
+    }
+    ReadMostlyList(const ReadMostlyList&) = delete;
+    ReadMostlyList& operator=(const ReadMostlyList&) = delete;
+    ~ReadMostlyList()
+    {
+        Node* p = toNode(head.load());
+        while (p)
+        {
+            Node* next = toNode(p->next.load());
+            delete p;
+            p = next;
+        }
+    }
+    // replace the node of key by a new node, old node is retired.
+    void replace(int key)
+    {
+        std::lock_guard lock(writeMutex);
+        std::atomic<std::uintptr_t>* prevNext = &head;
+        Node* cur = toNode(prevNext->load());
+        while (cur && cur->key != key)
+        {
+            prevNext = &cur->next;
+            cur = toNode(prevNext->load());
+        }
+        if (!cur)
+        {
+            return;
+        }
+        std::uintptr_t next = cur->next.fetch_or(markBit); // logically removed
+        prevNext->store(fromNode(new Node(key, next)));
+        retire(cur);
+    }
+    long long sum() const
+    {
+        if constexpr (UseEpoch)
+        {
+            EpochGuard guard; // only one fence for the whole traversal
+            long long res = 0;
+            for (Node* cur = toNode(head.load(std::memory_order_acquire)); cur; cur = toNode(cur->next.load(std::memory_order_acquire)))
+            {
+                res += cur->key;
+            }
+            return res;
+        }
+        else
+        {
+            HazardPointer hp[2]; // protect current node and its predecessor alternately
+        restart:
+            long long res = 0;
+            const std::atomic<std::uintptr_t>* prevNext = &head;
+            std::uintptr_t cur = prevNext->load(std::memory_order_acquire);
+            for (std::size_t i = 0; toNode(cur); i ^= 1)
+            {
+                hp[i].resetProtection(toNode(cur)); // one fence per node
+                if (prevNext->load(std::memory_order_seq_cst) != cur) // predecessor removed or changed
+                {
+                    goto restart;
+                }
+                res += toNode(cur)->key;
+                prevNext = &toNode(cur)->next;
+                cur = prevNext->load(std::memory_order_acquire);
+                if (cur & markBit) // current node has been removed
+                {
+                    goto restart;
+                }
+            }
+            return res;
+        }
+    }
+};
+
+template<bool UseEpoch>
+void benchmark(int readerCount, int listSize, int traversalsPerReader)
+{
+    ReadMostlyList<UseEpoch> L(listSize);
+    [[maybe_unused]] const long long expected = static_cast<long long>(listSize - 1) * listSize / 2;
+    std::atomic<bool> done = false;
+    std::atomic<int> replaced = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::jthread writer([&]() {
+            for (int i = 0; !done.load(); i = (i + 7) % listSize)
+            {
+                L.replace(i);
+                replaced.fetch_add(1);
+                std::this_thread::yield();
+            }
+        });
+        {
+            std::vector<std::jthread> readers;
+            for (int i = 0; i < readerCount; ++i)
+            {
+                readers.emplace_back([&]() {
+                    for (int j = 0; j < traversalsPerReader; ++j)
+                    {
+                        [[maybe_unused]] long long s = L.sum();
+                        assert(s == expected); // keys never change, only nodes are replaced
+                    }
+                });
+            }
+        }
+        done = true;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(16) << (UseEpoch ? "epoch" : "hazard pointer") << " : " << std::setw(2) << readerCount << " readers, "
+        << "list size " << listSize << ", " << std::setw(6) << replaced.load() << " replaced : "
+        << std::fixed << std::setprecision(2) << static_cast<double>(duration) * 1000 / (static_cast<double>(readerCount) * traversalsPerReader * listSize) << "ns/node" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    for (int readerCount : { 1, 2, 4, 8 })
+    {
+        benchmark<false>(readerCount, 1000, 2000);
+        benchmark<true>(readerCount, 1000, 2000);
+    }
+    std::cout << "reclaimed : hazard pointer " << HazardPointerDomain::instance().reclaimed()
+        << ", epoch " << EpochDomain::instance().reclaimed() << std::endl;
+    return 0;
+}
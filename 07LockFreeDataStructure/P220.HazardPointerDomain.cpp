@@ -0,0 +1,333 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// a reusable hazard pointer domain, lock-free data structures can adopt it by:
+// 1. reading a shared pointer through HazardPointer::protect before dereferencing it,
+// 2. passing a node to HazardPointerDomain::retire instead of deleting it after unlinking it.
+//
+// memory overhead (H = maxThreads * slotsPerThread, N = count of threads):
+// - slots: one cache line per thread record, maxThreads records at all.
+// - every thread scans all slots once it has retired threshold = 2 * H nodes, at most H of them survive a scan,
+//   so one thread holds less than 3 * H unreclaimed nodes, the whole domain holds O(N * H).
+// - nodes left by exited threads are adopted by the next scan of any thread.
+class HazardPointerDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t slotsPerThread = 4;
+private:
+    struct alignas(64) Record // one record per thread, avoid false sharing between threads
+    {
+        std::atomic<bool> active { false };
+        std::atomic<const void*> slots[slotsPerThread] {};
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+    };
+    // state of current thread, acquire a record on first use, and release it on thread exit.
+    class ThreadState
+    {
+        friend class HazardPointerDomain;
+        HazardPointerDomain& domain;
+        Record* record;
+        unsigned usedSlots; // bit mask
+        std::vector<RetiredPointer> retired;
+        std::vector<const void*> hazards; // reused by scan
+    public:
+        ThreadState(HazardPointerDomain& d) : domain(d), record(d.acquireRecord()), usedSlots(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            for (auto& slot : record->slots)
+            {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+            record->active.store(false, std::memory_order_release);
+            domain.scan(*this);
+            domain.orphan(retired);
+        }
+    };
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount; // high water mark of used records, scan only needs to read them
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans; // retired nodes of exited threads
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].active.load(std::memory_order_relaxed) && records[i].active.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    std::size_t threshold() const
+    {
+        return 2 * recordCount.load(std::memory_order_relaxed) * slotsPerThread;
+    }
+    void orphan(std::vector<RetiredPointer>& retired)
+    {
+        if (!retired.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+            retired.clear();
+        }
+    }
+    void scan(ThreadState& state)
+    {
+        {
+            std::unique_lock lock(orphanMutex, std::try_to_lock); // adopt nodes of exited threads
+            if (lock.owns_lock() && !orphans.empty())
+            {
+                state.retired.insert(state.retired.end(), orphans.begin(), orphans.end());
+                orphans.clear();
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pair with protect: either reader sees the node unlinked, or we see its hazard pointer
+        state.hazards.clear();
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (const auto& slot : records[i].slots)
+            {
+                if (const void* p = slot.load(std::memory_order_acquire))
+                {
+                    state.hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(state.hazards.begin(), state.hazards.end());
+        auto stillHazardous = std::partition(state.retired.begin(), state.retired.end(), [&](const RetiredPointer& r) {
+            return std::binary_search(state.hazards.begin(), state.hazards.end(), r.pointer);
+        });
+        for (auto iter = stillHazardous; iter != state.retired.end(); ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(state.retired.end() - stillHazardous, std::memory_order_relaxed);
+        state.retired.erase(stillHazardous, state.retired.end());
+    }
+    HazardPointerDomain() : recordCount(0), reclaimedCount(0) {}
+public:
+    HazardPointerDomain(const HazardPointerDomain&) = delete;
+    HazardPointerDomain& operator=(const HazardPointerDomain&) = delete;
+    ~HazardPointerDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static HazardPointerDomain& instance()
+    {
+        static HazardPointerDomain domain;
+        return domain;
+    }
+    // acquire/release a slot of current thread, used by HazardPointer
+    std::atomic<const void*>* acquireSlot()
+    {
+        ThreadState& state = threadState();
+        for (std::size_t i = 0; i < slotsPerThread; ++i)
+        {
+            if (!(state.usedSlots & (1u << i)))
+            {
+                state.usedSlots |= (1u << i);
+                return &state.record->slots[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer slots available in current thread");
+    }
+    void releaseSlot(std::atomic<const void*>* slot)
+    {
+        ThreadState& state = threadState();
+        slot->store(nullptr, std::memory_order_release);
+        state.usedSlots &= ~(1u << (slot - state.record->slots));
+    }
+    // p must have been unlinked from the data structure, it will be deleted when no hazard pointer points to it.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        state.retired.push_back({ p, deleter });
+        if (state.retired.size() >= threshold())
+        {
+            scan(state);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// RAII owner of a hazard pointer slot of current thread.
+class HazardPointer
+{
+    std::atomic<const void*>* slot;
+public:
+    HazardPointer() : slot(HazardPointerDomain::instance().acquireSlot()) {}
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+    ~HazardPointer()
+    {
+        HazardPointerDomain::instance().releaseSlot(slot);
+    }
+    // publish ptr, then check src still holds it. on failure ptr is updated to the new value of src.
+    template<typename T>
+    bool tryProtect(T*& ptr, const std::atomic<T*>& src)
+    {
+        T* p = ptr;
+        slot->store(p, std::memory_order_seq_cst); // store-load order: must be visible before src is re-read
+        ptr = src.load(std::memory_order_seq_cst);
+        if (ptr != p)
+        {
+            slot->store(nullptr, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    // returned pointer is safe to dereference until resetProtection or destruction.
+    template<typename T>
+    T* protect(const std::atomic<T*>& src)
+    {
+        T* p = src.load(std::memory_order_relaxed);
+        while (!tryProtect(p, src))
+        {
+        }
+        return p;
+    }
+    // publish a pointer which is already known to be safe (e.g. protected by another hazard pointer)
+    template<typename T>
+    void resetProtection(const T* p)
+    {
+        slot->store(p, std::memory_order_seq_cst);
+    }
+    void resetProtection()
+    {
+        slot->store(nullptr, std::memory_order_release);
+    }
+};
+
+// application: readers read the current config, writer replaces it and retires the old one.
+struct Config
+{
+    int version;
+    int values[15];
+    Config(int v) : version(v)
+    {
+        std::fill(std::begin(values), std::end(values), v);
+    }
+};
+std::atomic<Config*> currentConfig { new Config(0) };
+
+long long readConfig(int count)
+{
+    HazardPointer hp;
+    long long sum = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Config* config = hp.protect(currentConfig);
+        assert(config->values[14] == config->version); // never read a deleted config
+        sum += config->values[i % 15];
+        hp.resetProtection();
+    }
+    return sum;
+}
+
+void updateConfig(int count)
+{
+    for (int i = 1; i <= count; ++i)
+    {
+        Config* old = currentConfig.exchange(new Config(i));
+        HazardPointerDomain::instance().retire(old);
+    }
+}
+
+// microbenchmark: cost of protect on the read path, compared with a plain load.
+void benchmarkProtect(int threadCount, int count)
+{
+    auto measure = [&](auto read) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::vector<std::jthread> threads;
+            for (int i = 0; i < threadCount; ++i)
+            {
+                threads.emplace_back(read);
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return static_cast<double>(ns) / (static_cast<double>(count) * threadCount);
+    };
+    std::atomic<long long> sink = 0;
+    double plain = measure([&]() {
+        long long sum = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            sum += currentConfig.load(std::memory_order_acquire)->version;
+        }
+        sink += sum;
+    });
+    double hazard = measure([&]() {
+        HazardPointer hp;
+        long long sum = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            sum += hp.protect(currentConfig)->version;
+            hp.resetProtection();
+        }
+        sink += sum;
+    });
+    std::cout << std::setw(3) << threadCount << " threads : plain load " << std::fixed << std::setprecision(2) << plain
+        << "ns/read, protect " << hazard << "ns/read" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back(readConfig, 1000000);
+        }
+        threads.emplace_back(updateConfig, 100000);
+    }
+    std::cout << "reclaimed configs : " << HazardPointerDomain::instance().reclaimed() << " / 100000" << std::endl;
+
+    for (int threadCount : { 1, 2, 4, 8 })
+    {
+        benchmarkProtect(threadCount, 5000000);
+    }
+    delete currentConfig.load();
+    return 0;
+}
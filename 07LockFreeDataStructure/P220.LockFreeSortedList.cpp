@@ -0,0 +1,576 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstdint>
+#include <stdexcept>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// from P220.EpochBasedReclamation.cpp
+// epoch based reclamation (EBR):
+// readers only announce the global epoch once when entering a critical section (EpochGuard), not once per node.
+// a node retired in epoch e is deleted when global epoch reaches e + 2,
+// global epoch can only advance when every thread in critical section has announced the current epoch,
+// so all readers which might have seen the node have exited.
+// cost: a stalled reader blocks all reclamation, hazard pointers do not have this problem.
+class EpochDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t advanceInterval = 64; // try to advance epoch once per advanceInterval retires
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<bool> used { false };
+        std::atomic<std::uint64_t> state { 0 }; // (epoch << 1) | 1 when in critical section, 0 when quiescent
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+        std::uint64_t epoch;
+    };
+    class ThreadState
+    {
+        friend class EpochDomain;
+        EpochDomain& domain;
+        Record* record;
+        unsigned nesting;
+        std::vector<RetiredPointer> limbo; // ordered by epoch
+        std::size_t retiredSinceAdvance;
+    public:
+        ThreadState(EpochDomain& d) : domain(d), record(d.acquireRecord()), nesting(0), retiredSinceAdvance(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            record->state.store(0, std::memory_order_release);
+            record->used.store(false, std::memory_order_release);
+            domain.tryAdvance();
+            domain.reclaim(limbo);
+            domain.orphan(limbo);
+        }
+    };
+    std::atomic<std::uint64_t> globalEpoch;
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount;
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans;
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].used.load(std::memory_order_relaxed) && records[i].used.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No epoch records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    // advance global epoch if every thread in critical section has announced it.
+    void tryAdvance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::uint64_t s = records[i].state.load(std::memory_order_acquire);
+            if ((s & 1) && (s >> 1) != epoch)
+            {
+                return;
+            }
+        }
+        globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+    void reclaim(std::vector<RetiredPointer>& limbo)
+    {
+        const std::uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+        auto safeEnd = std::find_if(limbo.begin(), limbo.end(), [epoch](const RetiredPointer& r) { return r.epoch + 2 > epoch; });
+        for (auto iter = limbo.begin(); iter != safeEnd; ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(safeEnd - limbo.begin(), std::memory_order_relaxed);
+        limbo.erase(limbo.begin(), safeEnd);
+    }
+    void orphan(std::vector<RetiredPointer>& limbo)
+    {
+        if (!limbo.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), limbo.begin(), limbo.end());
+            limbo.clear();
+        }
+    }
+    void adoptOrphans(std::vector<RetiredPointer>& limbo)
+    {
+        std::unique_lock lock(orphanMutex, std::try_to_lock);
+        if (lock.owns_lock() && !orphans.empty())
+        {
+            limbo.insert(limbo.end(), orphans.begin(), orphans.end());
+            orphans.clear();
+            std::stable_sort(limbo.begin(), limbo.end(), [](const RetiredPointer& a, const RetiredPointer& b) { return a.epoch < b.epoch; });
+        }
+    }
+    EpochDomain() : globalEpoch(1), recordCount(0), reclaimedCount(0) {}
+public:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+    ~EpochDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static EpochDomain& instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+    void enter()
+    {
+        ThreadState& state = threadState();
+        if (state.nesting++ == 0)
+        {
+            state.record->state.store((globalEpoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // announce before reading any shared pointer, once per critical section
+        }
+    }
+    void exit()
+    {
+        ThreadState& state = threadState();
+        if (--state.nesting == 0)
+        {
+            state.record->state.store(0, std::memory_order_release);
+        }
+    }
+    // p must have been unlinked from the data structure.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        // order the caller's unlink before reading the epoch, otherwise the load may return an older epoch
+        // while a reader which entered in the newer one still holds p, and p would be freed one epoch too early.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        state.limbo.push_back({ p, deleter, globalEpoch.load(std::memory_order_acquire) });
+        if (++state.retiredSinceAdvance >= advanceInterval)
+        {
+            state.retiredSinceAdvance = 0;
+            adoptOrphans(state.limbo);
+            tryAdvance();
+            reclaim(state.limbo);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+class EpochGuard
+{
+public:
+    EpochGuard()
+    {
+        EpochDomain::instance().enter();
+    }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+    ~EpochGuard()
+    {
+        EpochDomain::instance().exit();
+    }
+};
+
+// lock-free sorted list (Harris, with Michael's changes for safe memory reclamation).
+// a node is erased in two steps: first its next pointer is marked (lowest bit), which logically removes it
+// and stops any insertion after it, then it is unlinked by a CAS on its predecessor.
+// writers unlink every marked node they pass (the thread whose CAS succeeds retires it),
+// readers (contains, forEach) skip marked nodes and never write the list, nodes they stand on
+// are kept alive by EpochGuard, whose only write goes to the thread's own record.
+template<typename T>
+class LockFreeSortedList
+{
+private:
+    struct Node
+    {
+        const T key;
+        std::atomic<std::uintptr_t> next;
+        Node(const T& k) : key(k), next(0) {}
+    };
+    static constexpr std::uintptr_t markBit = 1;
+    static Node* toNode(std::uintptr_t p)
+    {
+        return reinterpret_cast<Node*>(p & ~markBit);
+    }
+    static std::uintptr_t fromNode(Node* p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p);
+    }
+    std::atomic<std::uintptr_t> head;
+    // position of key: prev is the link to cur, cur is the first unmarked node not less than key (may be nullptr).
+    // marked nodes in between are unlinked. caller must hold an EpochGuard.
+    struct Position
+    {
+        std::atomic<std::uintptr_t>* prev;
+        Node* cur;
+    };
+    Position find(const T& key)
+    {
+    restart:
+        std::atomic<std::uintptr_t>* prev = &head;
+        Node* cur = toNode(prev->load(std::memory_order_acquire));
+        while (cur)
+        {
+            const std::uintptr_t next = cur->next.load(std::memory_order_acquire);
+            if (next & markBit) // cur is logically removed, help unlinking it
+            {
+                std::uintptr_t expected = fromNode(cur);
+                if (!prev->compare_exchange_strong(expected, next & ~markBit, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    goto restart; // prev changed or its node has been marked too
+                }
+                EpochDomain::instance().retire(cur);
+                cur = toNode(next);
+                continue;
+            }
+            if (!(cur->key < key))
+            {
+                break;
+            }
+            prev = &cur->next;
+            cur = toNode(next);
+        }
+        return { prev, cur };
+    }
+public:
+    LockFreeSortedList() : head(0) {}
+    LockFreeSortedList(const LockFreeSortedList&) = delete;
+    LockFreeSortedList& operator=(const LockFreeSortedList&) = delete;
+    ~LockFreeSortedList() // no other threads, unlinked nodes belong to the epoch domain
+    {
+        Node* p = toNode(head.load());
+        while (p)
+        {
+            Node* next = toNode(p->next.load());
+            delete p;
+            p = next;
+        }
+    }
+    // return false if key already exists
+    bool insert(const T& key)
+    {
+        EpochGuard guard;
+        std::unique_ptr<Node> newNode;
+        while (true)
+        {
+            Position pos = find(key);
+            if (pos.cur && !(key < pos.cur->key))
+            {
+                return false;
+            }
+            if (!newNode)
+            {
+                newNode = std::make_unique<Node>(key);
+            }
+            std::uintptr_t expected = fromNode(pos.cur);
+            newNode->next.store(expected, std::memory_order_relaxed);
+            if (pos.prev->compare_exchange_strong(expected, fromNode(newNode.get()), std::memory_order_release, std::memory_order_relaxed))
+            {
+                newNode.release();
+                return true;
+            }
+        }
+    }
+    // return false if key does not exist
+    bool erase(const T& key)
+    {
+        EpochGuard guard;
+        Position pos = find(key);
+        if (!pos.cur || key < pos.cur->key)
+        {
+            return false;
+        }
+        const std::uintptr_t next = pos.cur->next.fetch_or(markBit, std::memory_order_acq_rel); // logically removed
+        if (next & markBit) // erased by another thread first
+        {
+            return false;
+        }
+        std::uintptr_t expected = fromNode(pos.cur);
+        if (pos.prev->compare_exchange_strong(expected, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            EpochDomain::instance().retire(pos.cur);
+        }
+        else
+        {
+            find(key); // let find unlink it
+        }
+        return true;
+    }
+    bool contains(const T& key) const
+    {
+        EpochGuard guard;
+        Node* cur = toNode(head.load(std::memory_order_acquire));
+        while (cur && cur->key < key)
+        {
+            cur = toNode(cur->next.load(std::memory_order_acquire));
+        }
+        return cur && !(key < cur->key) && !(cur->next.load(std::memory_order_acquire) & markBit);
+    }
+    // visit keys in ascending order, keys inserted or erased during the traversal may or may not be seen.
+    template<typename Function>
+    void forEach(Function f) const
+    {
+        EpochGuard guard;
+        for (Node* cur = toNode(head.load(std::memory_order_acquire)); cur;)
+        {
+            const std::uintptr_t next = cur->next.load(std::memory_order_acquire);
+            if (!(next & markBit))
+            {
+                f(cur->key);
+            }
+            cur = toNode(next);
+        }
+    }
+};
+
+// from 06LockBasedDataStructure/P205.ThreadSafeLinkedList.cpp, for comparison
+template<typename T>
+class ThreadSafeList
+{
+private:
+    struct node
+    {
+        std::mutex m;
+        std::shared_ptr<T> data;
+        std::unique_ptr<node> next;
+        node() {}
+        node(const T& value) : data(std::make_shared<T>(value)) {}
+    };
+    node head; // head do not hold any data, it's a empty node.
+public:
+    ThreadSafeList() {}
+    ~ThreadSafeList()
+    {
+        removeIf([](const T&) { return true; });
+    }
+    ThreadSafeList(const ThreadSafeList&) = delete;
+    ThreadSafeList& operator=(const ThreadSafeList&) = delete;
+    void pushFront(const T& value)
+    {
+        std::unique_ptr<node> newNode = std::make_unique<node>(value);
+        std::lock_guard<std::mutex> lk(head.m);
+        newNode->next = std::move(head.next);
+        head.next = std::move(newNode);
+    }
+    template<typename Predicate>
+    std::shared_ptr<T> findFirstOf(Predicate p)
+    {
+        node* current = &head;
+        std::unique_lock<std::mutex> lk(head.m);
+        while (node* const next = current->next.get())
+        {
+            std::unique_lock<std::mutex> nextLk(next->m);
+            lk.unlock();
+            if (p(*next->data))
+            {
+                return next->data;
+            }
+            current = next;
+            lk = std::move(nextLk);
+        }
+        return std::shared_ptr<T>();
+    }
+    template<typename Predicate>
+    void removeIf(Predicate p)
+    {
+        node* current = &head;
+        std::unique_lock<std::mutex> lk(head.m);
+        while (node* const next = current->next.get())
+        {
+            std::unique_lock<std::mutex> nextLk(next->m);
+            if (p(*next->data)) // remove
+            {
+                std::unique_ptr<node> oldNext = std::move(current->next);
+                current->next = std::move(oldNext->next);
+                nextLk.unlock();
+            }
+            else // do not remove
+            {
+                lk.unlock();
+                current = next;
+                lk = std::move(nextLk);
+            }
+        }
+    }
+};
+
+// every thread inserts and erases its own keys while readers check that the list stays sorted
+void testConcurrentUpdates(int threadCount, int keysPerThread)
+{
+    LockFreeSortedList<int> L;
+    std::atomic<bool> done = false;
+    {
+        std::jthread reader([&]() {
+            while (!done.load())
+            {
+                int last = -1;
+                L.forEach([&last](int key) {
+                    assert(key > last);
+                    last = key;
+                });
+            }
+        });
+        std::vector<std::jthread> writers;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            writers.emplace_back([&, t]() {
+                for (int round = 0; round < 2; ++round)
+                {
+                    for (int i = 0; i < keysPerThread; ++i)
+                    {
+                        [[maybe_unused]] bool inserted = L.insert(i * threadCount + t);
+                        assert(inserted == (round == 0 || i % 2 == 0));
+                    }
+                    for (int i = 0; i < keysPerThread; i += 2) // odd ones are kept
+                    {
+                        [[maybe_unused]] bool erased = L.erase(i * threadCount + t);
+                        assert(erased);
+                    }
+                }
+            });
+        }
+        writers.clear();
+        done = true;
+    }
+    int count = 0;
+    L.forEach([&count, threadCount]([[maybe_unused]] int key) {
+        assert(key / threadCount % 2 == 1);
+        ++count;
+    });
+    assert(count == threadCount * (keysPerThread / 2) && L.contains(threadCount) && !L.contains(0));
+    std::cout << "concurrent updates : " << threadCount << " threads, " << count << " keys left" << std::endl;
+}
+
+// 90% contains, 5% insert, 5% erase on a list of about listSize keys.
+// the lock based list is not sorted, so it has to go through the whole list to find a missing key or to erase.
+template<bool LockFree>
+void benchmark(int threadCount, int listSize, int operationsPerThread)
+{
+    std::conditional_t<LockFree, LockFreeSortedList<int>, ThreadSafeList<int>> L;
+    for (int i = 0; i < listSize * 2; i += 2)
+    {
+        if constexpr (LockFree)
+        {
+            L.insert(i);
+        }
+        else
+        {
+            L.pushFront(i);
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> vec;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            vec.emplace_back([&, t]() {
+                std::mt19937 gen(t);
+                std::uniform_int_distribution<int> keyDist(0, listSize * 2 - 1);
+                std::uniform_int_distribution<int> opDist(0, 99);
+                for (int i = 0; i < operationsPerThread; ++i)
+                {
+                    const int key = keyDist(gen);
+                    const int op = opDist(gen);
+                    if constexpr (LockFree)
+                    {
+                        if (op < 5)
+                        {
+                            L.insert(key);
+                        }
+                        else if (op < 10)
+                        {
+                            L.erase(key);
+                        }
+                        else
+                        {
+                            L.contains(key);
+                        }
+                    }
+                    else
+                    {
+                        if (op < 5)
+                        {
+                            if (!L.findFirstOf([key](int k) { return k == key; }))
+                            {
+                                L.pushFront(key);
+                            }
+                        }
+                        else if (op < 10)
+                        {
+                            L.removeIf([key](int k) { return k == key; });
+                        }
+                        else
+                        {
+                            L.findFirstOf([key](int k) { return k == key; });
+                        }
+                    }
+                }
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(14) << (LockFree ? "lock-free" : "hand-over-hand") << " : " << std::setw(2) << threadCount << " threads, list size "
+        << listSize << " : " << std::fixed << std::setprecision(2) << static_cast<double>(duration) * 1000 / (static_cast<double>(threadCount) * operationsPerThread)
+        << "ns/op" << std::endl;
+}
+
+int main(int argc, char const *argv[])
+{
+    LockFreeSortedList<int> L;
+    for (int key : { 5, 1, 3, 4, 2 })
+    {
+        L.insert(key);
+    }
+    [[maybe_unused]] bool inserted = L.insert(3);
+    [[maybe_unused]] bool erased = L.erase(4);
+    [[maybe_unused]] bool erasedAgain = L.erase(4);
+    assert(!inserted && erased && !erasedAgain && L.contains(3) && !L.contains(4));
+    std::cout << "list : ";
+    L.forEach([](int key) { std::cout << key << " "; });
+    std::cout << std::endl;
+
+    testConcurrentUpdates(4, 2000);
+    for (int threadCount : { 1, 2, 4, 8 })
+    {
+        benchmark<false>(threadCount, 1000, 20000);
+        benchmark<true>(threadCount, 1000, 20000);
+    }
+    std::cout << "reclaimed : " << EpochDomain::instance().reclaimed() << std::endl;
+    return 0;
+}
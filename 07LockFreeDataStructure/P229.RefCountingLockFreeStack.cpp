@@ -0,0 +1,240 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// lock-free stack with split reference count, memory is reclaimed without hazard pointers.
+// - external count lives with the pointer to a node (in head or in next), it is increased each time a thread reads the pointer.
+// - internal count lives in the node, it is decreased each time a thread finishes with the node.
+// - when a node is popped, external count (minus 2: one for the list, one for the popping thread) is added to internal count,
+//   the node is deleted when the sum reaches zero.
+// counter and pointer must be modified together by one CAS. a two words struct needs 16 bytes CAS (cmpxchg16b),
+// which goes through libatomic and is not reported as lock-free by gcc. So the counter is packed into the high 16 bits of
+// the pointer (x86-64 and AArch64 user space pointers only use 48 bits), and 8 bytes CAS is enough.
+// limits of packing:
+// - a pointer wider than 48 bits (5-level paging) can not be stored, push throws instead of truncating it.
+// - external count has 16 bits and grows with every retry of pop while the node stays at head. at the maximum,
+//   increaseHeadCount yields until head changes instead of wrapping. the threads which have already counted can
+//   still pop, so one of them succeeds, but the waiting threads are blocked meanwhile: under such contention
+//   (65535 retries on one node) pop is not strictly lock-free.
+template<typename T>
+class SplitRefCountStack
+{
+private:
+    struct node;
+    class CountedNodePtr
+    {
+        static constexpr int pointerBits = 48;
+        static constexpr std::uint64_t pointerMask = (std::uint64_t(1) << pointerBits) - 1;
+        std::uint64_t value;
+    public:
+        static constexpr int maxExternalCount = (1 << (64 - pointerBits)) - 1;
+        CountedNodePtr() : value(0) {}
+        CountedNodePtr(node* p, int externalCount)
+            : value((std::uint64_t(externalCount) << pointerBits) | reinterpret_cast<std::uint64_t>(p))
+        {
+            assert(externalCount >= 0 && externalCount <= maxExternalCount);
+        }
+        static bool fits(const node* p) // checked in release builds too
+        {
+            return reinterpret_cast<std::uint64_t>(p) <= pointerMask;
+        }
+        node* ptr() const
+        {
+            return reinterpret_cast<node*>(value & pointerMask);
+        }
+        int externalCount() const
+        {
+            return static_cast<int>(value >> pointerBits);
+        }
+    };
+    struct node
+    {
+        std::shared_ptr<T> data;
+        std::atomic<int> internalCount;
+        CountedNodePtr next;
+        node(const T& value) : data(std::make_shared<T>(value)), internalCount(0) {}
+    };
+    std::atomic<CountedNodePtr> head;
+    void increaseHeadCount(CountedNodePtr& oldCounter)
+    {
+        CountedNodePtr newCounter;
+        do
+        {
+            while (oldCounter.externalCount() == CountedNodePtr::maxExternalCount) // do not wrap, wait until head changes
+            {
+                std::this_thread::yield();
+                oldCounter = head.load(std::memory_order_relaxed);
+            }
+            newCounter = CountedNodePtr(oldCounter.ptr(), oldCounter.externalCount() + 1);
+        } while (!head.compare_exchange_strong(oldCounter, newCounter, std::memory_order_acquire, std::memory_order_relaxed));
+        oldCounter = newCounter;
+    }
+public:
+    SplitRefCountStack() = default;
+    SplitRefCountStack(const SplitRefCountStack&) = delete;
+    SplitRefCountStack& operator=(const SplitRefCountStack&) = delete;
+    ~SplitRefCountStack()
+    {
+        while (pop())
+        {
+        }
+    }
+    static bool isLockFree()
+    {
+        return std::atomic<CountedNodePtr>::is_always_lock_free;
+    }
+    void push(const T& data)
+    {
+        node* p = new node(data);
+        if (!CountedNodePtr::fits(p))
+        {
+            delete p;
+            throw std::runtime_error("node address does not fit in 48 bits");
+        }
+        CountedNodePtr newNode(p, 1);
+        p->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(p->next, newNode, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    std::shared_ptr<T> pop()
+    {
+        CountedNodePtr oldHead = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            increaseHeadCount(oldHead); // now the node can not be deleted
+            node* const ptr = oldHead.ptr();
+            if (!ptr)
+            {
+                return std::shared_ptr<T>();
+            }
+            if (head.compare_exchange_strong(oldHead, ptr->next, std::memory_order_relaxed))
+            {
+                std::shared_ptr<T> res;
+                res.swap(ptr->data);
+                const int countIncrease = oldHead.externalCount() - 2;
+                if (ptr->internalCount.fetch_add(countIncrease, std::memory_order_release) == -countIncrease)
+                {
+                    delete ptr;
+                }
+                return res;
+            }
+            else if (ptr->internalCount.fetch_add(-1, std::memory_order_relaxed) == 1) // last reference
+            {
+                ptr->internalCount.load(std::memory_order_acquire);
+                delete ptr;
+            }
+        }
+    }
+    bool empty() const
+    {
+        return head.load().ptr() == nullptr;
+    }
+};
+
+// lock-free stack based on C++20 std::atomic<std::shared_ptr<node>>, reference counting is done by shared_ptr.
+// simple and correct, but whether it is lock-free depends on the implementation (check isLockFree).
+template<typename T>
+class SharedPtrStack
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        std::shared_ptr<node> next;
+        node(const T& value) : data(std::make_shared<T>(value)) {}
+    };
+    std::atomic<std::shared_ptr<node>> head;
+public:
+    SharedPtrStack() = default;
+    SharedPtrStack(const SharedPtrStack&) = delete;
+    SharedPtrStack& operator=(const SharedPtrStack&) = delete;
+    ~SharedPtrStack()
+    {
+        while (pop()) // avoid recursive destruction of a long chain
+        {
+        }
+    }
+    bool isLockFree() const
+    {
+        return head.is_lock_free();
+    }
+    void push(const T& data)
+    {
+        const std::shared_ptr<node> newNode = std::make_shared<node>(data);
+        newNode->next = head.load();
+        while (!head.compare_exchange_weak(newNode->next, newNode))
+        {
+        }
+    }
+    std::shared_ptr<T> pop()
+    {
+        std::shared_ptr<node> oldHead = head.load();
+        while (oldHead && !head.compare_exchange_weak(oldHead, oldHead->next))
+        {
+        }
+        if (oldHead)
+        {
+            oldHead->next = std::shared_ptr<node>(); // do not keep the rest of stack alive
+            return oldHead->data;
+        }
+        return std::shared_ptr<T>();
+    }
+    bool empty() const
+    {
+        return head.load() == nullptr;
+    }
+};
+
+// benchmark: every thread pushes and pops alternately, so a pop never finds the stack empty.
+template<typename Stack>
+long long benchmark(int threadCount, int totalOps)
+{
+    Stack S;
+    std::atomic<long long> sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([&S, &sum, ops = totalOps / threadCount]() {
+                long long localSum = 0;
+                for (int j = 0; j < ops; ++j)
+                {
+                    S.push(j);
+                    localSum += *S.pop();
+                }
+                sum += localSum;
+            });
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    assert(S.empty() && sum == threadCount * (totalOps / threadCount - 1LL) * (totalOps / threadCount) / 2);
+    return duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::cout << std::boolalpha;
+    std::cout << "split reference count stack is lock-free : " << SplitRefCountStack<int>::isLockFree() << std::endl;
+    std::cout << "atomic<shared_ptr> stack is lock-free    : " << SharedPtrStack<int>().isLockFree() << std::endl;
+
+    const int totalOps = 1 << 20;
+    std::cout << std::setw(8) << "threads" << std::setw(20) << "split count(us)" << std::setw(24) << "atomic<shared_ptr>(us)" << std::endl;
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 2)
+    {
+        std::cout << std::setw(8) << threadCount
+            << std::setw(20) << benchmark<SplitRefCountStack<int>>(threadCount, totalOps)
+            << std::setw(24) << benchmark<SharedPtrStack<int>>(threadCount, totalOps) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,428 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// hazard pointers: before dereferencing a shared node, a thread publishes its address in its own hazard pointer,
+// a removed node is only deleted when no hazard pointer points to it.
+constexpr std::size_t maxHazardPointers = 128; // max count of threads which use hazard pointers at the same time
+constexpr std::size_t hazardPointersPerThread = 2;
+
+struct HazardPointer
+{
+    std::atomic<bool> active { false };
+    std::atomic<void*> pointers[hazardPointersPerThread] {};
+};
+HazardPointer hazardPointers[maxHazardPointers];
+
+class HazardPointerOwner
+{
+    HazardPointer* hp;
+public:
+    HazardPointerOwner() : hp(nullptr)
+    {
+        for (std::size_t i = 0; i < maxHazardPointers; ++i)
+        {
+            bool expected = false;
+            if (hazardPointers[i].active.compare_exchange_strong(expected, true))
+            {
+                hp = &hazardPointers[i];
+                return;
+            }
+        }
+        throw std::runtime_error("No hazard pointers available");
+    }
+    HazardPointerOwner(const HazardPointerOwner&) = delete;
+    HazardPointerOwner& operator=(const HazardPointerOwner&) = delete;
+    ~HazardPointerOwner()
+    {
+        for (auto& p : hp->pointers)
+        {
+            p.store(nullptr);
+        }
+        hp->active.store(false);
+    }
+    std::atomic<void*>& getPointer(std::size_t index)
+    {
+        return hp->pointers[index];
+    }
+};
+
+std::atomic<void*>& getHazardPointerForCurrentThread(std::size_t index)
+{
+    thread_local static HazardPointerOwner owner;
+    return owner.getPointer(index);
+}
+
+// nodes removed by current thread, wait for reclamation.
+class RetireList
+{
+    struct RetiredPointer
+    {
+        void* pointer;
+        std::function<void(void*)> deleter;
+    };
+    std::vector<RetiredPointer> retired;
+    // amortized: scan all hazard pointers once per threshold retired nodes,
+    // so a thread never holds more than threshold + maxHazardPointers * hazardPointersPerThread unreclaimed nodes.
+    static constexpr std::size_t threshold = 2 * maxHazardPointers * hazardPointersPerThread;
+    void scan()
+    {
+        std::vector<void*> hazards;
+        for (const auto& hp : hazardPointers)
+        {
+            for (const auto& p : hp.pointers)
+            {
+                if (void* ptr = p.load())
+                {
+                    hazards.push_back(ptr);
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+        auto stillHazardous = std::partition(retired.begin(), retired.end(), [&](const RetiredPointer& r) {
+            return std::binary_search(hazards.begin(), hazards.end(), r.pointer);
+        });
+        for (auto iter = stillHazardous; iter != retired.end(); ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        retired.erase(stillHazardous, retired.end());
+    }
+public:
+    ~RetireList()
+    {
+        // hazard pointers are held only for a short time, wait for them on thread exit.
+        while (!retired.empty())
+        {
+            scan();
+            if (!retired.empty())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    template<typename T>
+    void add(T* p)
+    {
+        retired.push_back({ p, [](void* ptr) { delete static_cast<T*>(ptr); } });
+        if (retired.size() >= threshold)
+        {
+            scan();
+        }
+    }
+};
+
+template<typename T>
+void reclaimLater(T* p)
+{
+    thread_local static RetireList retireList;
+    retireList.add(p);
+}
+
+// Michael-Scott lock-free queue, same interface as ThreadSafeQueue in 06LockBasedDataStructure/P187.FineGrainedThreadSafeQueue.cpp
+// head always points to a dummy node, data of the first element is in head->next.
+template<typename T>
+class LockFreeQueue
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        std::atomic<node*> next;
+        node() : next(nullptr) {}
+    };
+    std::atomic<node*> head;
+    std::atomic<node*> tail;
+    std::atomic<unsigned> pushCount; // only for waitAndPop to block on
+    static node* protect(const std::atomic<node*>& src, std::atomic<void*>& hp)
+    {
+        node* p = src.load();
+        node* temp;
+        do
+        {
+            temp = p;
+            hp.store(p);
+            p = src.load();
+        } while (p != temp); // re-check after publishing, p can not be deleted now.
+        return p;
+    }
+public:
+    LockFreeQueue() : head(new node), tail(head.load()), pushCount(0) {}
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+    ~LockFreeQueue()
+    {
+        node* p = head.load();
+        while (p)
+        {
+            node* next = p->next.load();
+            delete p;
+            p = next;
+        }
+    }
+    void push(T value)
+    {
+        node* newNode = new node;
+        newNode->data = std::make_shared<T>(std::move(value));
+        std::atomic<void*>& hp = getHazardPointerForCurrentThread(0);
+        for (;;)
+        {
+            node* oldTail = protect(tail, hp);
+            node* next = oldTail->next.load();
+            if (next == nullptr)
+            {
+                if (oldTail->next.compare_exchange_weak(next, newNode))
+                {
+                    tail.compare_exchange_strong(oldTail, newNode); // failure means another thread has helped
+                    break;
+                }
+            }
+            else
+            {
+                tail.compare_exchange_strong(oldTail, next); // tail is lagging, help to move it forward
+            }
+        }
+        hp.store(nullptr);
+        pushCount.fetch_add(1);
+        pushCount.notify_one();
+    }
+    std::shared_ptr<T> tryPop()
+    {
+        std::atomic<void*>& hp0 = getHazardPointerForCurrentThread(0);
+        std::atomic<void*>& hp1 = getHazardPointerForCurrentThread(1);
+        std::shared_ptr<T> res;
+        for (;;)
+        {
+            node* oldHead = protect(head, hp0);
+            node* oldTail = tail.load();
+            node* next = oldHead->next.load();
+            hp1.store(next);
+            if (oldHead != head.load()) // oldHead is still head, so next is its successor and has not been retired.
+            {
+                continue;
+            }
+            if (next == nullptr) // empty
+            {
+                break;
+            }
+            if (oldHead == oldTail)
+            {
+                tail.compare_exchange_strong(oldTail, next);
+                continue;
+            }
+            if (head.compare_exchange_strong(oldHead, next))
+            {
+                res = std::move(next->data); // next is new dummy node, its data is only accessed by current thread.
+                hp0.store(nullptr);
+                reclaimLater(oldHead);
+                break;
+            }
+        }
+        hp0.store(nullptr);
+        hp1.store(nullptr);
+        return res;
+    }
+    bool tryPop(T& value)
+    {
+        std::shared_ptr<T> res = tryPop();
+        if (!res)
+        {
+            return false;
+        }
+        value = std::move(*res);
+        return true;
+    }
+    std::shared_ptr<T> waitAndPop()
+    {
+        for (;;)
+        {
+            unsigned count = pushCount.load();
+            if (std::shared_ptr<T> res = tryPop())
+            {
+                return res;
+            }
+            pushCount.wait(count); // return immediately if any push happened after load
+        }
+    }
+    void waitAndPop(T& value)
+    {
+        value = std::move(*waitAndPop());
+    }
+    bool empty() const
+    {
+        std::atomic<void*>& hp = getHazardPointerForCurrentThread(0);
+        node* oldHead = protect(head, hp);
+        bool res = oldHead->next.load() == nullptr;
+        hp.store(nullptr);
+        return res;
+    }
+};
+
+// from 06LockBasedDataStructure/P187.FineGrainedThreadSafeQueue.cpp, for comparison
+template<typename T>
+class ThreadSafeQueue
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        struct std::unique_ptr<node> next;
+    };
+    std::mutex headMutex;
+    std::unique_ptr<node> head;
+    std::mutex tailMutex;
+    node* tail;
+    std::condition_variable dataCond;
+    node* getTail()
+    {
+        std::lock_guard tailLock(tailMutex);
+        return tail;
+    }
+    std::unique_ptr<node> popHead()
+    {
+        std::unique_ptr<node> oldHead = std::move(head);
+        head = std::move(oldHead->next);
+        return oldHead;
+    }
+    std::unique_ptr<node> tryPopHead()
+    {
+        std::lock_guard headLock(headMutex);
+        if (head.get() == getTail())
+        {
+            return std::unique_ptr<node>();
+        }
+        return popHead();
+    }
+public:
+    ThreadSafeQueue() : head(std::make_unique<node>()), tail(head.get()) {}
+    ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue& other) = delete;
+    std::shared_ptr<T> tryPop()
+    {
+        std::unique_ptr<node> oldHead = tryPopHead();
+        return oldHead ? std::move(oldHead->data) : std::shared_ptr<T>();
+    }
+    void push(T value)
+    {
+        std::shared_ptr<T> newData = std::make_shared<T>(std::move(value));
+        std::unique_ptr<node> p = std::make_unique<node>();
+        node* newTail = p.get();
+        {
+            std::lock_guard tailLock(tailMutex);
+            tail->data = std::move(newData);
+            tail->next = std::move(p);
+            tail = newTail;
+        }
+        dataCond.notify_one();
+    }
+};
+
+// stress test: every element is popped exactly once, and elements of the same producer keep their order.
+void stressTest(int producerCount, int consumerCount, int countPerProducer)
+{
+    LockFreeQueue<std::pair<int, int>> Q; // (producer, sequence)
+    std::vector<std::atomic<int>> popped(static_cast<std::size_t>(producerCount) * countPerProducer);
+    std::atomic<int> remaining = producerCount * countPerProducer;
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < producerCount; ++i)
+        {
+            threads.emplace_back([&Q, i, countPerProducer]() {
+                for (int j = 0; j < countPerProducer; ++j)
+                {
+                    Q.push({ i, j });
+                }
+            });
+        }
+        for (int i = 0; i < consumerCount; ++i)
+        {
+            threads.emplace_back([&]() {
+                std::vector<int> lastSeen(producerCount, -1);
+                while (remaining.load() > 0)
+                {
+                    std::pair<int, int> value;
+                    if (!Q.tryPop(value))
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    assert(value.second > lastSeen[value.first]); // FIFO per producer
+                    lastSeen[value.first] = value.second;
+                    popped[value.first * countPerProducer + value.second].fetch_add(1);
+                    remaining.fetch_sub(1);
+                }
+            });
+        }
+    }
+    bool ok = Q.empty() && std::all_of(popped.begin(), popped.end(), [](const std::atomic<int>& c) { return c.load() == 1; });
+    std::cout << "stress test : " << producerCount << " producers, " << consumerCount << " consumers : " << (ok ? "passed" : "FAILED") << std::endl;
+}
+
+// benchmark: every thread pushes and pops alternately.
+template<typename Queue>
+long long benchmark(int threadCount, int totalOps)
+{
+    Queue Q;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([&Q, ops = totalOps / threadCount]() {
+                for (int j = 0; j < ops; ++j)
+                {
+                    Q.push(j);
+                    Q.tryPop();
+                }
+            });
+        }
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char const *argv[])
+{
+    LockFreeQueue<int> Q;
+    {
+        std::jthread producer([&Q]() {
+            for (int i = 0; i < 10; ++i)
+            {
+                Q.push(i);
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+        std::jthread consumer([&Q]() {
+            for (int i = 0; i < 10; ++i)
+            {
+                std::cout << *Q.waitAndPop() << " ";
+            }
+            std::cout << std::endl;
+        });
+    }
+
+    stressTest(1, 1, 100000);
+    stressTest(4, 4, 50000);
+    stressTest(8, 2, 20000);
+
+    const int totalOps = 400000;
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "two-lock(us)" << std::setw(16) << "lock-free(us)" << std::endl;
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 2)
+    {
+        std::cout << std::setw(8) << threadCount
+            << std::setw(16) << benchmark<ThreadSafeQueue<int>>(threadCount, totalOps)
+            << std::setw(16) << benchmark<LockFreeQueue<int>>(threadCount, totalOps) << std::endl;
+    }
+    return 0;
+}
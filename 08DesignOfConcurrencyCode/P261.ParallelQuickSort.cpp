@@ -9,6 +9,10 @@
 #include <numeric>
 #include <chrono>
 #include <random>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <stdexcept>
 
 using namespace std::chrono_literals;
 
@@ -50,7 +54,297 @@ public:
     }
 };
 
+// from 07LockFreeDataStructure/P220.HazardPointerDomain.cpp
+// 1. reading a shared pointer through HazardPointer::protect before dereferencing it,
+// 2. passing a node to HazardPointerDomain::retire instead of deleting it after unlinking it.
+//
+// memory overhead (H = maxThreads * slotsPerThread, N = count of threads):
+// - slots: one cache line per thread record, maxThreads records at all.
+// - every thread scans all slots once it has retired threshold = 2 * H nodes, at most H of them survive a scan,
+//   so one thread holds less than 3 * H unreclaimed nodes, the whole domain holds O(N * H).
+// - nodes left by exited threads are adopted by the next scan of any thread.
+class HazardPointerDomain
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+    static constexpr std::size_t slotsPerThread = 4;
+private:
+    struct alignas(64) Record // one record per thread, avoid false sharing between threads
+    {
+        std::atomic<bool> active { false };
+        std::atomic<const void*> slots[slotsPerThread] {};
+    };
+    struct RetiredPointer
+    {
+        void* pointer;
+        void (*deleter)(void*);
+    };
+    // state of current thread, acquire a record on first use, and release it on thread exit.
+    class ThreadState
+    {
+        friend class HazardPointerDomain;
+        HazardPointerDomain& domain;
+        Record* record;
+        unsigned usedSlots; // bit mask
+        std::vector<RetiredPointer> retired;
+        std::vector<const void*> hazards; // reused by scan
+    public:
+        ThreadState(HazardPointerDomain& d) : domain(d), record(d.acquireRecord()), usedSlots(0) {}
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+        ~ThreadState()
+        {
+            for (auto& slot : record->slots)
+            {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+            record->active.store(false, std::memory_order_release);
+            domain.scan(*this);
+            domain.orphan(retired);
+        }
+    };
+    Record records[maxThreads];
+    std::atomic<std::size_t> recordCount; // high water mark of used records, scan only needs to read them
+    std::mutex orphanMutex;
+    std::vector<RetiredPointer> orphans; // retired nodes of exited threads
+    std::atomic<std::size_t> reclaimedCount;
+    Record* acquireRecord()
+    {
+        for (std::size_t i = 0; i < maxThreads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].active.load(std::memory_order_relaxed) && records[i].active.compare_exchange_strong(expected, true))
+            {
+                std::size_t count = recordCount.load();
+                while (count < i + 1 && !recordCount.compare_exchange_weak(count, i + 1))
+                {
+                }
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer records available");
+    }
+    ThreadState& threadState()
+    {
+        thread_local static ThreadState state(*this);
+        return state;
+    }
+    std::size_t threshold() const
+    {
+        return 2 * recordCount.load(std::memory_order_relaxed) * slotsPerThread;
+    }
+    void orphan(std::vector<RetiredPointer>& retired)
+    {
+        if (!retired.empty())
+        {
+            std::lock_guard lock(orphanMutex);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+            retired.clear();
+        }
+    }
+    void scan(ThreadState& state)
+    {
+        {
+            std::unique_lock lock(orphanMutex, std::try_to_lock); // adopt nodes of exited threads
+            if (lock.owns_lock() && !orphans.empty())
+            {
+                state.retired.insert(state.retired.end(), orphans.begin(), orphans.end());
+                orphans.clear();
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pair with protect: either reader sees the node unlinked, or we see its hazard pointer
+        state.hazards.clear();
+        const std::size_t count = recordCount.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (const auto& slot : records[i].slots)
+            {
+                if (const void* p = slot.load(std::memory_order_acquire))
+                {
+                    state.hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(state.hazards.begin(), state.hazards.end());
+        auto stillHazardous = std::partition(state.retired.begin(), state.retired.end(), [&](const RetiredPointer& r) {
+            return std::binary_search(state.hazards.begin(), state.hazards.end(), r.pointer);
+        });
+        for (auto iter = stillHazardous; iter != state.retired.end(); ++iter)
+        {
+            iter->deleter(iter->pointer);
+        }
+        reclaimedCount.fetch_add(state.retired.end() - stillHazardous, std::memory_order_relaxed);
+        state.retired.erase(stillHazardous, state.retired.end());
+    }
+    HazardPointerDomain() : recordCount(0), reclaimedCount(0) {}
+public:
+    HazardPointerDomain(const HazardPointerDomain&) = delete;
+    HazardPointerDomain& operator=(const HazardPointerDomain&) = delete;
+    ~HazardPointerDomain()
+    {
+        for (auto& r : orphans) // no other threads at static destruction time
+        {
+            r.deleter(r.pointer);
+        }
+    }
+    static HazardPointerDomain& instance()
+    {
+        static HazardPointerDomain domain;
+        return domain;
+    }
+    // acquire/release a slot of current thread, used by HazardPointer
+    std::atomic<const void*>* acquireSlot()
+    {
+        ThreadState& state = threadState();
+        for (std::size_t i = 0; i < slotsPerThread; ++i)
+        {
+            if (!(state.usedSlots & (1u << i)))
+            {
+                state.usedSlots |= (1u << i);
+                return &state.record->slots[i];
+            }
+        }
+        throw std::runtime_error("No hazard pointer slots available in current thread");
+    }
+    void releaseSlot(std::atomic<const void*>* slot)
+    {
+        ThreadState& state = threadState();
+        slot->store(nullptr, std::memory_order_release);
+        state.usedSlots &= ~(1u << (slot - state.record->slots));
+    }
+    // p must have been unlinked from the data structure, it will be deleted when no hazard pointer points to it.
+    void retire(void* p, void (*deleter)(void*))
+    {
+        ThreadState& state = threadState();
+        state.retired.push_back({ p, deleter });
+        if (state.retired.size() >= threshold())
+        {
+            scan(state);
+        }
+    }
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* ptr) { delete static_cast<T*>(ptr); });
+    }
+    std::size_t reclaimed() const
+    {
+        return reclaimedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// RAII owner of a hazard pointer slot of current thread.
+class HazardPointer
+{
+    std::atomic<const void*>* slot;
+public:
+    HazardPointer() : slot(HazardPointerDomain::instance().acquireSlot()) {}
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+    ~HazardPointer()
+    {
+        HazardPointerDomain::instance().releaseSlot(slot);
+    }
+    // publish ptr, then check src still holds it. on failure ptr is updated to the new value of src.
+    template<typename T>
+    bool tryProtect(T*& ptr, const std::atomic<T*>& src)
+    {
+        T* p = ptr;
+        slot->store(p, std::memory_order_seq_cst); // store-load order: must be visible before src is re-read
+        ptr = src.load(std::memory_order_seq_cst);
+        if (ptr != p)
+        {
+            slot->store(nullptr, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    // returned pointer is safe to dereference until resetProtection or destruction.
+    template<typename T>
+    T* protect(const std::atomic<T*>& src)
+    {
+        T* p = src.load(std::memory_order_relaxed);
+        while (!tryProtect(p, src))
+        {
+        }
+        return p;
+    }
+    // publish a pointer which is already known to be safe (e.g. protected by another hazard pointer)
+    template<typename T>
+    void resetProtection(const T* p)
+    {
+        slot->store(p, std::memory_order_seq_cst);
+    }
+    void resetProtection()
+    {
+        slot->store(nullptr, std::memory_order_release);
+    }
+};
+
+// from 07LockFreeDataStructure/P212.LockFreeStack.cpp
+// Treiber lock-free stack:
+// push/pop replace head by CAS, a popped node is retired to hazard pointer domain instead of being deleted.
+// ABA: pop reads head A and A->next B, then CAS(head, A -> B). If meanwhile A was popped, deleted and a new node
+// reused the same address, CAS would succeed with a stale B. A protected A can not be deleted, so it can not be reused.
+// data is stored in node directly, pop moves it out to std::optional<T> without allocation.
 template<typename T>
+class LockFreeStack
+{
+private:
+    struct node
+    {
+        T data;
+        node* next;
+        node(T&& value) : data(std::move(value)), next(nullptr) {}
+    };
+    std::atomic<node*> head;
+public:
+    LockFreeStack() : head(nullptr) {}
+    LockFreeStack(const LockFreeStack&) = delete;
+    LockFreeStack& operator=(const LockFreeStack&) = delete;
+    ~LockFreeStack()
+    {
+        node* p = head.load();
+        while (p)
+        {
+            node* next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+    void push(T value)
+    {
+        node* newNode = new node(std::move(value));
+        newNode->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(newNode->next, newNode, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    std::optional<T> pop()
+    {
+        HazardPointer hp;
+        node* oldHead = hp.protect(head);
+        while (oldHead && !head.compare_exchange_strong(oldHead, oldHead->next))
+        {
+            oldHead = hp.protect(head);
+        }
+        hp.resetProtection();
+        if (!oldHead)
+        {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(oldHead->data)); // only current thread accesses data of popped node
+        HazardPointerDomain::instance().retire(oldHead);
+        return res;
+    }
+    bool empty() const
+    {
+        return head.load() == nullptr;
+    }
+};
+
+// Stack: stack of chunks, ThreadSafeStack or LockFreeStack, pop returns a nullable handle of chunk.
+template<typename T, template<typename> class Stack = ThreadSafeStack>
 struct QuickSorter
 {
     struct ChunkToSort
@@ -58,7 +352,7 @@ struct QuickSorter
         std::list<T> data;
         std::promise<std::list<T>> promise;
     };
-    ThreadSafeStack<ChunkToSort> chunks;
+    Stack<ChunkToSort> chunks;
     std::vector<std::jthread> threads;
     const std::size_t maxThreadCount;
     std::atomic<bool> endOfData;
@@ -76,7 +370,7 @@ struct QuickSorter
         auto chunk = chunks.pop();
         if (chunk)
         {
-            sortChunk(chunk);
+            sortChunk(*chunk);
         }
     }
     std::list<T> doSort(std::list<T>& chunkData)
@@ -95,7 +389,7 @@ struct QuickSorter
         chunks.push(std::move(newLowerChunk));
         if (threads.size() < maxThreadCount)
         {
-            threads.emplace_back(std::jthread(&QuickSorter<T>::sortThread, this));
+            threads.emplace_back(std::jthread(&QuickSorter::sortThread, this));
         }
         std::list<T> newHigher(doSort(chunkData));
         result.splice(result.end(), newHigher);
@@ -106,9 +400,9 @@ struct QuickSorter
         result.splice(result.begin(), newLower.get());
         return result;
     }
-    void sortChunk(const std::shared_ptr<ChunkToSort>& chunk)
+    void sortChunk(ChunkToSort& chunk)
     {
-        chunk->promise.set_value(doSort(chunk->data));
+        chunk.promise.set_value(doSort(chunk.data));
     }
     void sortThread()
     {
@@ -120,14 +414,14 @@ struct QuickSorter
     }
 };
 
-template<typename T>
+template<typename T, template<typename> class Stack = ThreadSafeStack>
 std::list<T> parallelQuickSort(std::list<T> input)
 {
     if (input.empty())
     {
         return input;
     }
-    QuickSorter<T> s;
+    QuickSorter<T, Stack> s;
     return s.doSort(input);
 }
 
@@ -144,5 +438,7 @@ int main(int argc, char const *argv[])
     }
     std::cout << std::endl;
     std::cout << std::boolalpha << std::is_sorted(res.begin(), res.end()) << std::endl;
+    auto lockFreeRes = parallelQuickSort<int, LockFreeStack>(ltest); // chunks in a lock-free stack
+    std::cout << std::boolalpha << (lockFreeRes == res) << std::endl;
     return 0;
 }
@@ -0,0 +1,421 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stack>
+#include <queue>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <optional>
+#include <variant>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+// index of current thread in [0, maxThreads), used to find its publication record, released on thread exit.
+class ThreadIndex
+{
+public:
+    static constexpr std::size_t maxThreads = 128;
+private:
+    static inline std::atomic<bool> used[maxThreads] {};
+    static inline std::atomic<std::size_t> highWater { 0 };
+    struct Holder
+    {
+        std::size_t index;
+        Holder()
+        {
+            for (index = 0; index < maxThreads; ++index)
+            {
+                bool expected = false;
+                if (used[index].compare_exchange_strong(expected, true))
+                {
+                    std::size_t count = highWater.load();
+                    while (count < index + 1 && !highWater.compare_exchange_weak(count, index + 1))
+                    {
+                    }
+                    return;
+                }
+            }
+            throw std::runtime_error("Too many threads");
+        }
+        ~Holder()
+        {
+            used[index].store(false);
+        }
+    };
+public:
+    static std::size_t get()
+    {
+        thread_local static Holder holder;
+        return holder.index;
+    }
+    static std::size_t count()
+    {
+        return highWater.load(std::memory_order_acquire);
+    }
+};
+
+// flat combining: wrap a sequential container (std::stack, std::queue, std::unordered_map...) into a concurrent one.
+// a thread publishes its operation into its own record, then tries to take the lock (a combining flag).
+// the thread which gets the lock becomes the combiner, it applies all published operations against the container,
+// the other threads spin on the done flag of their own request, and only read the combining flag:
+// the exchange is tried only after a plain load sees it clear, so waiters never write the lock's cache line
+// while a combiner is working, and never touch the container.
+// so the container and the lock stay in cache of the combiner, lock handoff happens once per batch instead of once per operation.
+template<typename Container>
+class FlatCombining
+{
+private:
+    struct Request
+    {
+        void (*invoke)(Request*, Container&);
+        std::atomic<bool> done { false };
+        std::exception_ptr error;
+    };
+    template<typename Function, typename Result>
+    struct TypedRequest : Request
+    {
+        Function& func;
+        std::optional<std::conditional_t<std::is_void_v<Result>, std::monostate, Result>> result;
+        TypedRequest(Function& f) : func(f)
+        {
+            this->invoke = [](Request* base, Container& c) {
+                auto* self = static_cast<TypedRequest*>(base);
+                if constexpr (std::is_void_v<Result>)
+                {
+                    self->func(c);
+                }
+                else
+                {
+                    self->result.emplace(self->func(c));
+                }
+            };
+        }
+    };
+    struct alignas(64) Record
+    {
+        std::atomic<Request*> request { nullptr };
+    };
+    static constexpr int combinePasses = 3; // scan records several times to catch operations published during combining
+    Container container;
+    alignas(64) std::atomic<bool> combining; // the lock, on its own cache line
+    Record records[ThreadIndex::maxThreads];
+    std::atomic<std::size_t> combinedCount;
+    std::atomic<std::size_t> batchCount;
+    void combine() // combining must be owned
+    {
+        std::size_t combined = 0;
+        for (int pass = 0; pass < combinePasses; ++pass)
+        {
+            std::size_t found = 0;
+            const std::size_t count = ThreadIndex::count();
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                Request* r = records[i].request.load(std::memory_order_acquire);
+                if (!r)
+                {
+                    continue;
+                }
+                records[i].request.store(nullptr, std::memory_order_relaxed);
+                try
+                {
+                    r->invoke(r, container);
+                }
+                catch (...)
+                {
+                    r->error = std::current_exception(); // rethrown in the thread which published the operation
+                }
+                r->done.store(true, std::memory_order_release);
+                ++found;
+            }
+            if (found == 0)
+            {
+                break;
+            }
+            combined += found;
+        }
+        combinedCount.fetch_add(combined, std::memory_order_relaxed);
+        batchCount.fetch_add(1, std::memory_order_relaxed);
+    }
+public:
+    FlatCombining() : combining(false), combinedCount(0), batchCount(0) {}
+    FlatCombining(const FlatCombining&) = delete;
+    FlatCombining& operator=(const FlatCombining&) = delete;
+    // apply func(Container&) under the lock by whichever thread is combining, return its result.
+    template<typename Function>
+    auto execute(Function func)
+    {
+        using Result = std::invoke_result_t<Function&, Container&>;
+        TypedRequest<Function, Result> req(func);
+        records[ThreadIndex::get()].request.store(&req, std::memory_order_release);
+        while (!req.done.load(std::memory_order_acquire))
+        {
+            if (!combining.load(std::memory_order_relaxed) && !combining.exchange(true, std::memory_order_acquire))
+            {
+                combine(); // own request is served too, unless another combiner has done it
+                combining.store(false, std::memory_order_release);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        if (req.error)
+        {
+            std::rethrow_exception(req.error);
+        }
+        if constexpr (!std::is_void_v<Result>)
+        {
+            return std::move(*req.result);
+        }
+    }
+    // average count of operations applied by one combiner
+    double averageBatch() const
+    {
+        std::size_t batches = batchCount.load(std::memory_order_relaxed);
+        return batches ? static_cast<double>(combinedCount.load(std::memory_order_relaxed)) / batches : 0.0;
+    }
+};
+
+// from 03ShareData/P49.ThreadSafeStack.cpp, for comparison
+struct empty_stack : std::exception
+{
+    virtual const char* what() const noexcept override
+    {
+        return "threadsafe_stack is empty!";
+    }
+};
+
+template<typename T>
+class threadsafe_stack
+{
+private:
+    std::stack<T> data;
+    mutable std::mutex m;
+public:
+    threadsafe_stack() {}
+    threadsafe_stack& operator=(const threadsafe_stack& other) = delete;
+    void push(T new_value)
+    {
+        std::lock_guard lock(m);
+        data.push(std::move(new_value));
+    }
+    std::shared_ptr<T> pop()
+    {
+        std::lock_guard lock(m);
+        if (data.empty())
+        {
+            throw empty_stack();
+        }
+        const std::shared_ptr<T> res(std::make_shared<T>(std::move(data.top())));
+        data.pop();
+        return res;
+    }
+};
+
+// from 06LockBasedDataStructure/P185.ThreadSafeQueue.cpp, for comparison
+template<typename T>
+class ThreadSafeQueue
+{
+private:
+    mutable std::mutex mut;
+    std::queue<std::shared_ptr<T>> data;
+public:
+    ThreadSafeQueue() {}
+    ThreadSafeQueue(const ThreadSafeQueue& other) = delete;
+    ThreadSafeQueue& operator=(const ThreadSafeQueue&) = delete;
+    void push(T value)
+    {
+        std::shared_ptr<T> newValuePtr = std::make_shared<T>(std::move(value));
+        std::lock_guard lg(mut);
+        data.push(newValuePtr);
+    }
+    std::shared_ptr<T> try_pop()
+    {
+        std::lock_guard lg(mut);
+        if (data.empty())
+        {
+            return std::shared_ptr<T>();
+        }
+        std::shared_ptr<T> res = data.front();
+        data.pop();
+        return res;
+    }
+};
+
+// from 06LockBasedDataStructure/P201.ThreadSafeLookupTable.cpp, for comparison
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ThreadSafeLookupTable
+{
+private:
+    class BucketType
+    {
+    private:
+        using BucketValue = std::pair<Key, Value>;
+        using BucketData = std::list<BucketValue>;
+        BucketData m_data;
+        mutable std::shared_mutex m_mutex;
+        auto findEntryFor(const Key& key) const
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+        auto findEntryFor(const Key& key)
+        {
+            return std::find_if(m_data.begin(), m_data.end(), [&](const BucketValue& item) -> bool { return item.first == key; });
+        }
+    public:
+        Value valueFor(const Key& key, const Value& defaultValue) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            return (foundEntry == m_data.end()) ? defaultValue : foundEntry->second;
+        }
+        void addOrUpdateMapping(const Key& key, const Value& value)
+        {
+            std::lock_guard<std::shared_mutex> lock(m_mutex);
+            auto foundEntry = findEntryFor(key);
+            if (foundEntry == m_data.end())
+            {
+                m_data.emplace_back(key, value);
+            }
+            else
+            {
+                foundEntry->second = value;
+            }
+        }
+    };
+    std::vector<std::unique_ptr<BucketType>> m_buckets;
+    Hash m_hasher;
+    BucketType& getBucket(const Key& key) const
+    {
+        const std::size_t bucketIndex = m_hasher(key) % m_buckets.size();
+        return *m_buckets[bucketIndex];
+    }
+public:
+    ThreadSafeLookupTable(std::size_t numBuckets = 19, const Hash& hasher = Hash())
+        : m_buckets(numBuckets)
+        , m_hasher(hasher)
+    {
+        for (std::size_t i = 0; i < numBuckets; ++i)
+        {
+            m_buckets[i].reset(new BucketType());
+        }
+    }
+    ThreadSafeLookupTable(const ThreadSafeLookupTable&) = delete;
+    ThreadSafeLookupTable& operator=(const ThreadSafeLookupTable&) = delete;
+    Value valueFor(const Key& key, const Value& defaultValue = Value()) const
+    {
+        return getBucket(key).valueFor(key, defaultValue);
+    }
+    void addOrUpdateMapping(const Key& key, const Value& value)
+    {
+        getBucket(key).addOrUpdateMapping(key, value);
+    }
+};
+
+// run body(threadIndex, opIndex) on threadCount threads, return microseconds.
+template<typename Body>
+long long timeThreads(int threadCount, int opsPerThread, Body body)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([&body, i, opsPerThread]() {
+                for (int j = 0; j < opsPerThread; ++j)
+                {
+                    body(i, j);
+                }
+            });
+        }
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char const *argv[])
+{
+    FlatCombining<std::stack<int>> fcStack;
+    fcStack.execute([](std::stack<int>& s) { s.push(1); });
+    [[maybe_unused]] int top = fcStack.execute([](std::stack<int>& s) { int v = s.top(); s.pop(); return v; });
+    assert(top == 1);
+    try
+    {
+        fcStack.execute([](std::stack<int>& s) -> int {
+            if (s.empty())
+            {
+                throw empty_stack();
+            }
+            return s.top();
+        });
+    }
+    catch (const empty_stack& e)
+    {
+        std::cout << "exception from combiner : " << e.what() << std::endl;
+    }
+
+    const int totalOps = 1 << 18;
+    std::cout << std::setw(8) << "threads" << std::setw(10) << "" << std::setw(14) << "lock(us)" << std::setw(14) << "fc(us)" << std::setw(12) << "fc batch" << std::endl;
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 4)
+    {
+        const int ops = totalOps / threadCount;
+        {
+            threadsafe_stack<int> S;
+            FlatCombining<std::stack<int>> FS;
+            long long t0 = timeThreads(threadCount, ops, [&S](int, int j) { S.push(j); S.pop(); });
+            long long t1 = timeThreads(threadCount, ops, [&FS](int, int j) {
+                FS.execute([j](std::stack<int>& s) { s.push(j); });
+                FS.execute([](std::stack<int>& s) { int v = s.top(); s.pop(); return v; });
+            });
+            std::cout << std::setw(8) << threadCount << std::setw(10) << "stack" << std::setw(14) << t0 << std::setw(14) << t1
+                << std::setw(12) << std::fixed << std::setprecision(2) << FS.averageBatch() << std::endl;
+        }
+        {
+            ThreadSafeQueue<int> Q;
+            FlatCombining<std::queue<int>> FQ;
+            long long t0 = timeThreads(threadCount, ops, [&Q](int, int j) { Q.push(j); Q.try_pop(); });
+            long long t1 = timeThreads(threadCount, ops, [&FQ](int, int j) {
+                FQ.execute([j](std::queue<int>& q) { q.push(j); });
+                FQ.execute([](std::queue<int>& q) -> std::optional<int> {
+                    if (q.empty())
+                    {
+                        return std::nullopt;
+                    }
+                    int v = q.front();
+                    q.pop();
+                    return v;
+                });
+            });
+            std::cout << std::setw(8) << threadCount << std::setw(10) << "queue" << std::setw(14) << t0 << std::setw(14) << t1
+                << std::setw(12) << FQ.averageBatch() << std::endl;
+        }
+        {
+            ThreadSafeLookupTable<int, std::string> T;
+            FlatCombining<std::unordered_map<int, std::string>> FT;
+            long long t0 = timeThreads(threadCount, ops, [&T](int i, int j) {
+                const int key = (i * 31 + j) % 1024;
+                T.addOrUpdateMapping(key, "value");
+                T.valueFor(key);
+            });
+            long long t1 = timeThreads(threadCount, ops, [&FT](int i, int j) {
+                const int key = (i * 31 + j) % 1024;
+                FT.execute([key](std::unordered_map<int, std::string>& m) { m[key] = "value"; });
+                FT.execute([key](std::unordered_map<int, std::string>& m) { auto iter = m.find(key); return iter == m.end() ? std::string() : iter->second; });
+            });
+            std::cout << std::setw(8) << threadCount << std::setw(10) << "table" << std::setw(14) << t0 << std::setw(14) << t1
+                << std::setw(12) << FT.averageBatch() << std::endl;
+        }
+    }
+    return 0;
+}